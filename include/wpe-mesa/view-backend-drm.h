@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_view_backend_drm_h
+#define wpe_mesa_view_backend_drm_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct wpe_view_backend;
+
+/*
+ * Selects the connector and mode used by DRM view backends created after
+ * this call, overriding the WPE_DRM_CONNECTOR and WPE_DRM_MODE environment
+ * variables. Either argument may be NULL to use the default behavior.
+ *
+ * The connector is given by its name, e.g. "HDMI-A-1", or as a comma-separated
+ * list when several views each drive their own output. The mode is one of
+ * "preferred", "<W>x<H>", "<W>x<H>@<Hz>", "max-refresh" or
+ * "max-refresh:<W>x<H>", the latter picking the highest refresh rate among
+ * the modes that fit in the given pixel budget.
+ */
+void
+wpe_mesa_view_backend_drm_set_output_policy(const char* connector, const char* mode);
+
+/*
+ * Enables variable refresh rate on outputs that support it, overriding the
+ * WPE_DRM_VRR environment variable. Frames are then presented as soon as they
+ * are ready, within the refresh range of the panel. Outputs without adaptive
+ * sync support, or driven without atomic modesetting, keep a fixed refresh.
+ * Applies to modesets performed after this call.
+ */
+void
+wpe_mesa_view_backend_drm_set_adaptive_sync(int enabled);
+
+/*
+ * Rotates and scales the output with the given connector name, or every
+ * output when it is NULL, overriding the WPE_DRM_ROTATION and
+ * WPE_DRM_RENDER_SIZE environment variables. The rotation is 0, 90, 180 or
+ * 270 degrees counter-clockwise; a non-zero render size makes the view render
+ * at that size, scaled to the mode by the display plane. Views report the
+ * resulting logical size, which for 90 and 270 degrees has the mode's width
+ * and height swapped. Requires atomic modesetting; applies to views created
+ * after this call and to outputs that are reconfigured by a hotplug event.
+ */
+void
+wpe_mesa_view_backend_drm_set_output_transform(const char* connector, uint32_t rotation, uint32_t render_width, uint32_t render_height);
+
+/*
+ * Sets the image shown on the hardware cursor plane of the output driven by
+ * the given DRM view backend. Pixels are premultiplied ARGB8888, with rows
+ * stride bytes apart; images larger than the hardware cursor are clipped.
+ * The image is rotated along with the output, but not scaled with its render
+ * size. Passing NULL pixels hides the cursor.
+ */
+void
+wpe_mesa_view_backend_drm_set_cursor_image(struct wpe_view_backend*, const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t stride, int32_t hotspot_x, int32_t hotspot_y);
+
+/*
+ * Moves the cursor hotspot to the given position in view coordinates, the
+ * same as input events use. The position is mapped through the rotation and
+ * render size of the output. Only the cursor plane is updated; no new frame
+ * is rendered.
+ */
+void
+wpe_mesa_view_backend_drm_move_cursor(struct wpe_view_backend*, int32_t x, int32_t y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // wpe_mesa_view_backend_drm_h
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_view_backend_wayland_h
+#define wpe_mesa_view_backend_wayland_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct wpe_view_backend;
+
+struct wpe_mesa_view_backend_wayland_subsurface;
+
+struct wpe_mesa_view_backend_wayland_dma_buf {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t modifier;
+    uint32_t num_planes;
+    int32_t fds[4];
+    uint32_t offsets[4];
+    uint32_t strides[4];
+};
+
+/*
+ * Creates a layer of its own above the surface of the given Wayland view
+ * backend, for content like video that the compositor can then scan out from
+ * an overlay plane instead of it being composited into every frame of the
+ * view. Buffers are shown as they are attached, independently of the frames
+ * of the view. The layer takes no input, which keeps going to the view.
+ * Returns NULL when the backend isn't a Wayland one or the compositor has no
+ * wl_subcompositor.
+ */
+struct wpe_mesa_view_backend_wayland_subsurface*
+wpe_mesa_view_backend_wayland_create_subsurface(struct wpe_view_backend*);
+
+/*
+ * Destroys the layer. Buffers still held by the compositor are released
+ * through their callbacks. Also valid after the view backend was destroyed,
+ * which only leaves the layer inert.
+ */
+void
+wpe_mesa_view_backend_wayland_subsurface_destroy(struct wpe_mesa_view_backend_wayland_subsurface*);
+
+/*
+ * Moves the layer to the given position in surface coordinates of the view,
+ * and places it above or below the view surface, where it is only visible
+ * through transparent parts of the view, e.g. for hole-punched video.
+ */
+void
+wpe_mesa_view_backend_wayland_subsurface_set_position(struct wpe_mesa_view_backend_wayland_subsurface*, int32_t x, int32_t y);
+
+void
+wpe_mesa_view_backend_wayland_subsurface_set_stacking(struct wpe_mesa_view_backend_wayland_subsurface*, int above);
+
+/*
+ * Shows buffers at the given size, scaled by the compositor, instead of their
+ * own. Needs wp_viewporter; a size of 0x0 goes back to the buffer size.
+ */
+void
+wpe_mesa_view_backend_wayland_subsurface_set_size(struct wpe_mesa_view_backend_wayland_subsurface*, uint32_t width, uint32_t height);
+
+/*
+ * Shows the given dma-buf on the layer, or hides the layer when it is NULL.
+ * The fds remain owned by the caller, and can be closed once this returns.
+ * The release callback is called in the main context once the compositor no
+ * longer reads from the buffer. Returns 0 on success, -1 if the buffer
+ * couldn't be imported, in which case the callback isn't called.
+ */
+int
+wpe_mesa_view_backend_wayland_subsurface_attach(struct wpe_mesa_view_backend_wayland_subsurface*, const struct wpe_mesa_view_backend_wayland_dma_buf*, void (*release)(void*), void* user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // wpe_mesa_view_backend_wayland_h
@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "drm-device.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <gbm.h>
+#include <glib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#if defined(WPE_MESA_DRM_HOTPLUG) && WPE_MESA_DRM_HOTPLUG
+#include <libudev.h>
+#endif
+
+namespace DRM {
+
+class EventSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+
+    int drmFD;
+    drmEventContext eventContext;
+};
+
+GSourceFuncs EventSource::sourceFuncs = {
+    nullptr, // prepare
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto* source = reinterpret_cast<EventSource*>(base);
+        return !!source->pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<EventSource*>(base);
+
+        if (source->pfd.revents & G_IO_IN)
+            drmHandleEvent(source->drmFD, &source->eventContext);
+
+        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source->pfd.revents = 0;
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+#if defined(WPE_MESA_DRM_HOTPLUG) && WPE_MESA_DRM_HOTPLUG
+class UdevSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+
+    struct udev_monitor* monitor;
+    dev_t devnum;
+    Device* device;
+};
+
+GSourceFuncs UdevSource::sourceFuncs = {
+    nullptr, // prepare
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto* source = reinterpret_cast<UdevSource*>(base);
+        return !!source->pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<UdevSource*>(base);
+
+        if (source->pfd.revents & G_IO_IN) {
+            struct udev_device* udevDevice = udev_monitor_receive_device(source->monitor);
+            if (udevDevice) {
+                const char* hotplug = udev_device_get_property_value(udevDevice, "HOTPLUG");
+                if (udev_device_get_devnum(udevDevice) == source->devnum && hotplug && !std::strcmp(hotplug, "1")) {
+                    // Recent kernels name the connector that changed, which spares
+                    // re-probing all the others.
+                    const char* connector = udev_device_get_property_value(udevDevice, "CONNECTOR");
+                    source->device->handleHotplug(connector ? std::strtoul(connector, nullptr, 10) : 0);
+                }
+                udev_device_unref(udevDevice);
+            }
+        }
+
+        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source->pfd.revents = 0;
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+#endif
+
+Device& Device::singleton()
+{
+    static Device device;
+    return device;
+}
+
+Device::Device()
+{
+    // FIXME: This path should be retrieved via udev.
+    const char* renderCard = getenv("WPE_RENDER_CARD");
+    if (!renderCard)
+        renderCard = "/dev/dri/card0";
+    m_path = renderCard;
+
+    int fd = open(renderCard, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "DRM::Device: couldn't connect DRM to card %s\n", renderCard);
+        return;
+    }
+
+    drm_magic_t magic;
+    if (drmGetMagic(fd, &magic) || drmAuthMagic(fd, magic)) {
+        close(fd);
+        return;
+    }
+
+    m_gbmDevice = gbm_create_device(fd);
+    if (!m_gbmDevice) {
+        close(fd);
+        return;
+    }
+
+    m_fd = fd;
+    m_probe = probeOutputs(m_fd);
+
+    // Plane rotation and scaling are only reachable through atomic commits.
+    if (!getenv("WPE_DRM_DISABLE_ATOMIC")) {
+        m_atomic = !drmSetClientCap(m_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)
+            && !drmSetClientCap(m_fd, DRM_CLIENT_CAP_ATOMIC, 1);
+    }
+
+    uint64_t cursorWidth, cursorHeight;
+    if (!drmGetCap(m_fd, DRM_CAP_CURSOR_WIDTH, &cursorWidth) && !drmGetCap(m_fd, DRM_CAP_CURSOR_HEIGHT, &cursorHeight))
+        m_cursorSize = { cursorWidth, cursorHeight };
+
+    m_source = g_source_new(&EventSource::sourceFuncs, sizeof(EventSource));
+    auto* source = reinterpret_cast<EventSource*>(m_source);
+    source->drmFD = m_fd;
+    source->eventContext = {
+        DRM_EVENT_CONTEXT_VERSION,
+        nullptr,
+        nullptr,
+        &Device::pageFlipHandler,
+    };
+
+    source->pfd.fd = m_fd;
+    source->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source->pfd.revents = 0;
+    g_source_add_poll(m_source, &source->pfd);
+
+    g_source_set_name(m_source, "[WPE] DRM");
+    g_source_set_priority(m_source, G_PRIORITY_HIGH + 30);
+    g_source_set_can_recurse(m_source, TRUE);
+    g_source_attach(m_source, g_main_context_get_thread_default());
+
+#if defined(WPE_MESA_DRM_HOTPLUG) && WPE_MESA_DRM_HOTPLUG
+    struct stat fdStat;
+    if (fstat(m_fd, &fdStat) == -1)
+        return;
+
+    m_udev.context = udev_new();
+    if (!m_udev.context)
+        return;
+
+    m_udev.monitor = udev_monitor_new_from_netlink(m_udev.context, "udev");
+    if (!m_udev.monitor) {
+        fprintf(stderr, "DRM::Device: couldn't create a udev monitor, hotplug is disabled\n");
+        return;
+    }
+
+    udev_monitor_filter_add_match_subsystem_devtype(m_udev.monitor, "drm", "drm_minor");
+    udev_monitor_enable_receiving(m_udev.monitor);
+
+    m_udev.source = g_source_new(&UdevSource::sourceFuncs, sizeof(UdevSource));
+    auto* udevSource = reinterpret_cast<UdevSource*>(m_udev.source);
+    udevSource->monitor = m_udev.monitor;
+    udevSource->devnum = fdStat.st_rdev;
+    udevSource->device = this;
+
+    udevSource->pfd.fd = udev_monitor_get_fd(m_udev.monitor);
+    udevSource->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    udevSource->pfd.revents = 0;
+    g_source_add_poll(m_udev.source, &udevSource->pfd);
+
+    g_source_set_name(m_udev.source, "[WPE] DRM hotplug");
+    g_source_set_priority(m_udev.source, G_PRIORITY_DEFAULT);
+    g_source_attach(m_udev.source, g_main_context_get_thread_default());
+#endif
+}
+
+Device::~Device()
+{
+#if defined(WPE_MESA_DRM_HOTPLUG) && WPE_MESA_DRM_HOTPLUG
+    if (m_udev.source) {
+        g_source_destroy(m_udev.source);
+        g_source_unref(m_udev.source);
+    }
+    if (m_udev.monitor)
+        udev_monitor_unref(m_udev.monitor);
+    if (m_udev.context)
+        udev_unref(m_udev.context);
+    m_udev = { };
+#endif
+
+    if (m_source) {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+    }
+    m_source = nullptr;
+
+    if (m_gbmDevice)
+        gbm_device_destroy(m_gbmDevice);
+    m_gbmDevice = nullptr;
+
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+}
+
+const ConnectorInfo* Device::connector(uint32_t connectorId) const
+{
+    for (auto& connector : m_probe.connectors) {
+        if (connector.id == connectorId)
+            return &connector;
+    }
+    return nullptr;
+}
+
+void Device::registerClient(Client& client)
+{
+    m_clients.push_back(&client);
+}
+
+void Device::unregisterClient(Client& client)
+{
+    releaseOutput(client);
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), &client), m_clients.end());
+}
+
+void Device::handleHotplug(uint32_t connectorId)
+{
+    bool probed = false;
+    if (connectorId) {
+        for (auto& connector : m_probe.connectors) {
+            if (connector.id == connectorId) {
+                probed = probeConnector(m_fd, connectorId, m_probe.crtcs, connector);
+                break;
+            }
+        }
+    }
+
+    // Connectors can also appear and disappear altogether, e.g. with DP MST.
+    if (!probed)
+        m_probe = probeOutputs(m_fd);
+
+    auto clients = m_clients;
+    for (auto* client : clients)
+        client->outputsChanged();
+}
+
+bool Device::claimOutput(Client& client, const OutputPolicy& policy, Output& output)
+{
+    if (!isValid())
+        return false;
+
+    std::vector<uint32_t> claimedConnectors;
+    for (auto& it : m_bindings)
+        claimedConnectors.push_back(it.second.connectorId);
+
+    OutputSelection selection = selectOutput(m_probe, policy, claimedConnectors);
+    if (!selection.connector || !selection.mode)
+        return false;
+
+    // Keep the CRTC already driving the connector if it's free, otherwise
+    // take the first compatible one that no other output is using.
+    uint32_t crtcId = selection.connector->crtcId;
+    if (!crtcId || m_bindings.count(crtcId)) {
+        crtcId = 0;
+        for (size_t i = 0; i < m_probe.crtcs.size(); ++i) {
+            if ((selection.connector->possibleCrtcs & (1 << i)) && !m_bindings.count(m_probe.crtcs[i])) {
+                crtcId = m_probe.crtcs[i];
+                break;
+            }
+        }
+    }
+
+    if (!crtcId) {
+        fprintf(stderr, "DRM::Device: no free CRTC for connector %s\n", selection.connector->name.c_str());
+        return false;
+    }
+
+    output.connectorId = selection.connector->id;
+    output.crtcId = crtcId;
+    output.planeId = 0;
+    if (m_atomic) {
+        size_t crtcIndex = std::find(m_probe.crtcs.begin(), m_probe.crtcs.end(), crtcId) - m_probe.crtcs.begin();
+        output.planeId = primaryPlane(crtcIndex);
+        if (!output.planeId)
+            fprintf(stderr, "DRM::Device: no primary plane for CRTC %u, using legacy modesetting\n", crtcId);
+    }
+    output.name = selection.connector->name;
+    output.mode = *selection.mode;
+
+    m_bindings.insert({ crtcId, { &client, output.connectorId } });
+    return true;
+}
+
+void Device::releaseOutput(Client& client)
+{
+    for (auto it = m_bindings.begin(); it != m_bindings.end(); ++it) {
+        if (it->second.client == &client) {
+            m_bindings.erase(it);
+            return;
+        }
+    }
+}
+
+int Device::pageFlip(uint32_t crtcId, uint32_t fbId)
+{
+    // The CRTC is also passed as user data, for kernels that don't report
+    // it in the event themselves.
+    return drmModePageFlip(m_fd, crtcId, fbId, DRM_MODE_PAGE_FLIP_EVENT, reinterpret_cast<void*>(uintptr_t(crtcId)));
+}
+
+uint32_t Device::propertyId(uint32_t objectId, uint32_t objectType, const char* name)
+{
+    auto key = std::make_pair(objectId, std::string(name));
+    auto it = m_propertyIds.find(key);
+    if (it != m_propertyIds.end())
+        return it->second;
+
+    uint32_t id = 0;
+    drmModeObjectProperties* properties = drmModeObjectGetProperties(m_fd, objectId, objectType);
+    if (properties) {
+        for (uint32_t i = 0; i < properties->count_props && !id; ++i) {
+            drmModePropertyRes* property = drmModeGetProperty(m_fd, properties->props[i]);
+            if (!property)
+                continue;
+            if (!std::strcmp(property->name, name))
+                id = property->prop_id;
+            drmModeFreeProperty(property);
+        }
+        drmModeFreeObjectProperties(properties);
+    }
+
+    // Missing properties are cached too, so optional ones are only looked up once.
+    m_propertyIds.insert({ key, id });
+    return id;
+}
+
+bool Device::addProperty(drmModeAtomicReq* request, uint32_t objectId, uint32_t objectType, const char* name, uint64_t value)
+{
+    uint32_t id = propertyId(objectId, objectType, name);
+    return id && drmModeAtomicAddProperty(request, objectId, id, value) > 0;
+}
+
+int Device::atomicCommit(drmModeAtomicReq* request, uint32_t flags, uint32_t crtcId)
+{
+    return drmModeAtomicCommit(m_fd, request, flags, reinterpret_cast<void*>(uintptr_t(crtcId)));
+}
+
+uint32_t Device::primaryPlane(size_t crtcIndex)
+{
+    drmModePlaneRes* planes = drmModeGetPlaneResources(m_fd);
+    if (!planes)
+        return 0;
+
+    uint32_t planeId = 0;
+    for (uint32_t i = 0; i < planes->count_planes && !planeId; ++i) {
+        drmModePlane* plane = drmModeGetPlane(m_fd, planes->planes[i]);
+        if (!plane)
+            continue;
+
+        if (plane->possible_crtcs & (1 << crtcIndex)) {
+            drmModeObjectProperties* properties = drmModeObjectGetProperties(m_fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
+            uint32_t typeId = propertyId(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type");
+            for (uint32_t j = 0; properties && j < properties->count_props; ++j) {
+                if (properties->props[j] == typeId && properties->prop_values[j] == DRM_PLANE_TYPE_PRIMARY)
+                    planeId = plane->plane_id;
+            }
+            if (properties)
+                drmModeFreeObjectProperties(properties);
+        }
+        drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(planes);
+    return planeId;
+}
+
+bool Device::createDumbBuffer(uint32_t width, uint32_t height, DumbBuffer& buffer)
+{
+    struct drm_mode_create_dumb createData = { };
+    createData.width = width;
+    createData.height = height;
+    createData.bpp = 32;
+    if (drmIoctl(m_fd, DRM_IOCTL_MODE_CREATE_DUMB, &createData)) {
+        fprintf(stderr, "DRM::Device: failed to create a %ux%u dumb buffer: %s\n", width, height, strerror(errno));
+        return false;
+    }
+
+    buffer.handle = createData.handle;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.pitch = createData.pitch;
+    buffer.size = createData.size;
+
+    struct drm_mode_map_dumb mapData = { };
+    mapData.handle = buffer.handle;
+    if (!drmIoctl(m_fd, DRM_IOCTL_MODE_MAP_DUMB, &mapData)) {
+        void* data = mmap(nullptr, buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, mapData.offset);
+        if (data != MAP_FAILED) {
+            buffer.data = data;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "DRM::Device: failed to map a dumb buffer: %s\n", strerror(errno));
+    destroyDumbBuffer(buffer);
+    return false;
+}
+
+void Device::destroyDumbBuffer(DumbBuffer& buffer)
+{
+    if (buffer.data)
+        munmap(buffer.data, buffer.size);
+
+    if (buffer.handle) {
+        struct drm_mode_destroy_dumb destroyData = { };
+        destroyData.handle = buffer.handle;
+        drmIoctl(m_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyData);
+    }
+
+    buffer = DumbBuffer();
+}
+
+void Device::pageFlipHandler(int, unsigned sequence, unsigned sec, unsigned usec, unsigned crtcId, void* data)
+{
+    if (!crtcId)
+        crtcId = uintptr_t(data);
+
+    // Outputs released while a flip was in flight are simply not found.
+    auto& bindings = singleton().m_bindings;
+    auto it = bindings.find(crtcId);
+    if (it != bindings.end())
+        it->second.client->pageFlipped(sequence, sec, usec);
+}
+
+} // namespace DRM
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_drm_device_h
+#define wpe_mesa_drm_device_h
+
+#include "drm-output.h"
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct _drmModeAtomicReq;
+struct gbm_device;
+struct udev;
+struct udev_monitor;
+
+typedef struct _GSource GSource;
+
+namespace DRM {
+
+// Per-process owner of the DRM card. All views share its fd, gbm_device,
+// probed resources and event source; each view binds to its own connector
+// and CRTC, and page flip events are routed back to it by CRTC.
+class Device {
+public:
+    class Client {
+    public:
+        virtual void pageFlipped(unsigned sequence, unsigned sec, unsigned usec) = 0;
+        virtual void outputsChanged() = 0;
+    };
+
+    struct Output {
+        uint32_t connectorId { 0 };
+        uint32_t crtcId { 0 };
+        // Only known when atomic modesetting is available.
+        uint32_t planeId { 0 };
+        std::string name;
+        drmModeModeInfo mode;
+    };
+
+    struct DumbBuffer {
+        uint32_t handle { 0 };
+        uint32_t width { 0 };
+        uint32_t height { 0 };
+        uint32_t pitch { 0 };
+        uint64_t size { 0 };
+        void* data { nullptr };
+    };
+
+    static Device& singleton();
+
+    bool isValid() const { return m_fd >= 0 && m_gbmDevice; }
+    int fd() const { return m_fd; }
+    struct gbm_device* gbmDevice() const { return m_gbmDevice; }
+    const ProbeResult& probeResult() const { return m_probe; }
+    const ConnectorInfo* connector(uint32_t) const;
+
+    // Registered clients are notified whenever a hotplug event changes the
+    // probed connectors, whether or not they currently own an output.
+    void registerClient(Client&);
+    void unregisterClient(Client&);
+
+    bool claimOutput(Client&, const OutputPolicy&, Output&);
+    void releaseOutput(Client&);
+
+    void handleHotplug(uint32_t connectorId);
+
+    int pageFlip(uint32_t crtcId, uint32_t fbId);
+
+    // Atomic modesetting, used when the driver supports it. Property ids are
+    // looked up by name once and cached afterwards.
+    bool supportsAtomic() const { return m_atomic; }
+    uint32_t propertyId(uint32_t objectId, uint32_t objectType, const char* name);
+    bool addProperty(struct _drmModeAtomicReq*, uint32_t objectId, uint32_t objectType, const char* name, uint64_t value);
+    int atomicCommit(struct _drmModeAtomicReq*, uint32_t flags, uint32_t crtcId);
+
+    // CPU-mapped 32bpp buffers, used for the cursor.
+    bool createDumbBuffer(uint32_t width, uint32_t height, DumbBuffer&);
+    void destroyDumbBuffer(DumbBuffer&);
+
+    std::pair<uint32_t, uint32_t> cursorSize() const { return m_cursorSize; }
+
+private:
+    Device();
+    ~Device();
+
+    static void pageFlipHandler(int, unsigned, unsigned, unsigned, unsigned, void*);
+
+    uint32_t primaryPlane(size_t crtcIndex);
+
+    std::string m_path;
+    int m_fd { -1 };
+    struct gbm_device* m_gbmDevice { nullptr };
+    ProbeResult m_probe;
+    std::pair<uint32_t, uint32_t> m_cursorSize { 64, 64 };
+    bool m_atomic { false };
+    std::map<std::pair<uint32_t, std::string>, uint32_t> m_propertyIds;
+
+    GSource* m_source { nullptr };
+
+#if defined(WPE_MESA_DRM_HOTPLUG) && WPE_MESA_DRM_HOTPLUG
+    struct {
+        struct udev* context { nullptr };
+        struct udev_monitor* monitor { nullptr };
+        GSource* source { nullptr };
+    } m_udev;
+#endif
+
+    std::vector<Client*> m_clients;
+
+    struct Binding {
+        Client* client;
+        uint32_t connectorId;
+    };
+    std::unordered_map<uint32_t, Binding> m_bindings;
+};
+
+} // namespace DRM
+
+#endif // wpe_mesa_drm_device_h
@@ -0,0 +1,628 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "drm-input.h"
+
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/input.h>
+#include <string>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon-compose.h>
+#include <xkbcommon/xkbcommon.h>
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+#include <libinput.h>
+#include <libudev.h>
+#else
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#endif
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+namespace DRM {
+
+// Without a compositor there are no repeat settings to follow, so use the
+// usual defaults.
+static const unsigned s_repeatDelay = 400;
+static const unsigned s_repeatRate = 25;
+
+static uint32_t eventTime(uint64_t time)
+{
+    return time / 1000;
+}
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+class LibinputSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+};
+
+GSourceFuncs LibinputSource::sourceFuncs = {
+    nullptr, // prepare
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto* source = reinterpret_cast<LibinputSource*>(base);
+        return !!source->pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<LibinputSource*>(base);
+
+        if (source->pfd.revents & G_IO_IN)
+            Input::singleton().dispatchLibinput();
+
+        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source->pfd.revents = 0;
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+static const struct libinput_interface s_libinputInterface = {
+    // open_restricted
+    [](const char* path, int flags, void*) -> int
+    {
+        int fd = open(path, flags | O_CLOEXEC);
+        return fd < 0 ? -errno : fd;
+    },
+    // close_restricted
+    [](int fd, void*)
+    {
+        close(fd);
+    },
+};
+#else
+class EvdevSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+};
+
+GSourceFuncs EvdevSource::sourceFuncs = {
+    nullptr, // prepare
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto* source = reinterpret_cast<EvdevSource*>(base);
+        return !!source->pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<EvdevSource*>(base);
+
+        if (source->pfd.revents & G_IO_IN)
+            Input::singleton().readEvdev(source->pfd.fd);
+
+        // Unplugged devices are simply dropped; there is no hotplug for raw
+        // evdev devices.
+        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source->pfd.revents = 0;
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+#endif
+
+Input& Input::singleton()
+{
+    static Input input;
+    return input;
+}
+
+Input::Input()
+{
+    m_keyRepeat.setInfo(s_repeatRate, s_repeatDelay);
+
+    for (auto& point : m_touch.points)
+        point = { wpe_input_touch_event_type_null, 0, 0, 0, 0 };
+    m_touch.changed.fill(false);
+
+    // The keymap follows the usual XKB_DEFAULT_* environment variables.
+    m_xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (m_xkb.context) {
+        m_xkb.keymap = xkb_keymap_new_from_names(m_xkb.context, nullptr, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        m_xkb.composeTable = xkb_compose_table_new_from_locale(m_xkb.context, setlocale(LC_CTYPE, nullptr), XKB_COMPOSE_COMPILE_NO_FLAGS);
+    }
+    if (m_xkb.keymap) {
+        m_xkb.state = xkb_state_new(m_xkb.keymap);
+        m_xkb.control = xkb_keymap_mod_get_index(m_xkb.keymap, XKB_MOD_NAME_CTRL);
+        m_xkb.alt = xkb_keymap_mod_get_index(m_xkb.keymap, XKB_MOD_NAME_ALT);
+        m_xkb.shift = xkb_keymap_mod_get_index(m_xkb.keymap, XKB_MOD_NAME_SHIFT);
+    } else
+        fprintf(stderr, "DRM::Input: couldn't compile a keymap, keyboard input is disabled\n");
+    if (m_xkb.composeTable)
+        m_xkb.composeState = xkb_compose_state_new(m_xkb.composeTable, XKB_COMPOSE_STATE_NO_FLAGS);
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+    m_udev = udev_new();
+    if (!m_udev)
+        return;
+
+    m_libinput = libinput_udev_create_context(&s_libinputInterface, this, m_udev);
+    if (!m_libinput) {
+        fprintf(stderr, "DRM::Input: couldn't create a libinput context\n");
+        return;
+    }
+
+    const char* seat = getenv("WPE_DRM_SEAT");
+    if (libinput_udev_assign_seat(m_libinput, seat ? seat : "seat0")) {
+        fprintf(stderr, "DRM::Input: couldn't assign seat %s\n", seat ? seat : "seat0");
+        return;
+    }
+
+    m_source = g_source_new(&LibinputSource::sourceFuncs, sizeof(LibinputSource));
+    auto* source = reinterpret_cast<LibinputSource*>(m_source);
+    source->pfd.fd = libinput_get_fd(m_libinput);
+    source->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source->pfd.revents = 0;
+    g_source_add_poll(m_source, &source->pfd);
+
+    g_source_set_name(m_source, "[WPE] DRM input");
+    g_source_set_priority(m_source, G_PRIORITY_DEFAULT);
+    g_source_set_can_recurse(m_source, TRUE);
+    g_source_attach(m_source, g_main_context_get_thread_default());
+
+    // Pick up the devices that are already plugged in.
+    dispatchLibinput();
+#else
+    DIR* directory = opendir("/dev/input");
+    if (!directory)
+        return;
+
+    while (struct dirent* entry = readdir(directory)) {
+        if (std::strncmp(entry->d_name, "event", 5))
+            continue;
+
+        std::string path = std::string("/dev/input/") + entry->d_name;
+        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        int clock = CLOCK_MONOTONIC;
+        ioctl(fd, EVIOCSCLOCKID, &clock);
+
+        GSource* source = g_source_new(&EvdevSource::sourceFuncs, sizeof(EvdevSource));
+        auto* evdevSource = reinterpret_cast<EvdevSource*>(source);
+        evdevSource->pfd.fd = fd;
+        evdevSource->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+        evdevSource->pfd.revents = 0;
+        g_source_add_poll(source, &evdevSource->pfd);
+
+        g_source_set_name(source, "[WPE] DRM input");
+        g_source_set_priority(source, G_PRIORITY_DEFAULT);
+        g_source_set_can_recurse(source, TRUE);
+        g_source_attach(source, g_main_context_get_thread_default());
+
+        m_devices.push_back({ fd, source });
+    }
+    closedir(directory);
+
+    if (m_devices.empty())
+        fprintf(stderr, "DRM::Input: no readable input devices\n");
+#endif
+}
+
+Input::~Input()
+{
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+    if (m_source) {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+    }
+    if (m_libinput)
+        libinput_unref(m_libinput);
+    if (m_udev)
+        udev_unref(m_udev);
+#else
+    for (auto& device : m_devices) {
+        g_source_destroy(device.second);
+        g_source_unref(device.second);
+        close(device.first);
+    }
+#endif
+
+    if (m_xkb.composeState)
+        xkb_compose_state_unref(m_xkb.composeState);
+    if (m_xkb.composeTable)
+        xkb_compose_table_unref(m_xkb.composeTable);
+    if (m_xkb.state)
+        xkb_state_unref(m_xkb.state);
+    if (m_xkb.keymap)
+        xkb_keymap_unref(m_xkb.keymap);
+    if (m_xkb.context)
+        xkb_context_unref(m_xkb.context);
+}
+
+// A held key doesn't go on repeating into another client.
+void Input::addClient(Client& client)
+{
+    m_keyRepeat.stop();
+    m_clients.push_back(&client);
+}
+
+void Input::removeClient(Client& client)
+{
+    if (focus() == &client)
+        m_keyRepeat.stop();
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), &client), m_clients.end());
+}
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+void Input::dispatchLibinput()
+{
+    // Everything read in one go comes from complete kernel frames, so it is
+    // dispatched as a single batch.
+    libinput_dispatch(m_libinput);
+
+    std::pair<uint32_t, uint32_t> size { 0, 0 };
+    if (auto* client = focus())
+        size = client->inputSize();
+
+    while (struct libinput_event* event = libinput_get_event(m_libinput)) {
+        switch (libinput_event_get_type(event)) {
+        case LIBINPUT_EVENT_KEYBOARD_KEY:
+        {
+            auto* keyEvent = libinput_event_get_keyboard_event(event);
+            key(libinput_event_keyboard_get_key(keyEvent),
+                libinput_event_keyboard_get_key_state(keyEvent) == LIBINPUT_KEY_STATE_PRESSED,
+                libinput_event_keyboard_get_time_usec(keyEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_POINTER_MOTION:
+        {
+            auto* pointerEvent = libinput_event_get_pointer_event(event);
+            pointerMotion(libinput_event_pointer_get_dx(pointerEvent), libinput_event_pointer_get_dy(pointerEvent),
+                libinput_event_pointer_get_time_usec(pointerEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+        {
+            auto* pointerEvent = libinput_event_get_pointer_event(event);
+            pointerMotionAbsolute(libinput_event_pointer_get_absolute_x_transformed(pointerEvent, size.first),
+                libinput_event_pointer_get_absolute_y_transformed(pointerEvent, size.second),
+                libinput_event_pointer_get_time_usec(pointerEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_POINTER_BUTTON:
+        {
+            auto* pointerEvent = libinput_event_get_pointer_event(event);
+            pointerButton(libinput_event_pointer_get_button(pointerEvent),
+                libinput_event_pointer_get_button_state(pointerEvent) == LIBINPUT_BUTTON_STATE_PRESSED,
+                libinput_event_pointer_get_time_usec(pointerEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_POINTER_AXIS:
+        {
+            auto* pointerEvent = libinput_event_get_pointer_event(event);
+            uint64_t time = libinput_event_pointer_get_time_usec(pointerEvent);
+            if (libinput_event_pointer_has_axis(pointerEvent, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL))
+                pointerAxis(0, -libinput_event_pointer_get_axis_value(pointerEvent, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL), time);
+            if (libinput_event_pointer_has_axis(pointerEvent, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL))
+                pointerAxis(1, -libinput_event_pointer_get_axis_value(pointerEvent, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL), time);
+            break;
+        }
+        case LIBINPUT_EVENT_TOUCH_DOWN:
+        case LIBINPUT_EVENT_TOUCH_MOTION:
+        {
+            auto* touchEvent = libinput_event_get_touch_event(event);
+            touch(libinput_event_get_type(event) == LIBINPUT_EVENT_TOUCH_DOWN ? wpe_input_touch_event_type_down : wpe_input_touch_event_type_motion,
+                libinput_event_touch_get_seat_slot(touchEvent),
+                libinput_event_touch_get_x_transformed(touchEvent, size.first),
+                libinput_event_touch_get_y_transformed(touchEvent, size.second),
+                libinput_event_touch_get_time_usec(touchEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_TOUCH_UP:
+        {
+            auto* touchEvent = libinput_event_get_touch_event(event);
+            touch(wpe_input_touch_event_type_up, libinput_event_touch_get_seat_slot(touchEvent), 0, 0,
+                libinput_event_touch_get_time_usec(touchEvent));
+            break;
+        }
+        case LIBINPUT_EVENT_TOUCH_FRAME:
+            frame();
+            break;
+        default:
+            break;
+        }
+
+        libinput_event_destroy(event);
+    }
+
+    frame();
+}
+#else
+void Input::readEvdev(int fd)
+{
+    struct {
+        double dx { 0 };
+        double dy { 0 };
+        int32_t wheel { 0 };
+        int32_t hwheel { 0 };
+        bool dropped { false };
+    } pending;
+
+    struct input_event events[64];
+    ssize_t length;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (size_t i = 0; i < length / sizeof(struct input_event); ++i) {
+            auto& event = events[i];
+            uint64_t time = uint64_t(event.input_event_sec) * 1000000 + event.input_event_usec;
+
+            // After an overflow, everything up to the next report is stale.
+            if (pending.dropped) {
+                if (event.type == EV_SYN && event.code == SYN_REPORT)
+                    pending = { };
+                continue;
+            }
+
+            switch (event.type) {
+            case EV_SYN:
+                if (event.code == SYN_DROPPED) {
+                    pending = { };
+                    pending.dropped = true;
+                    break;
+                }
+                if (event.code != SYN_REPORT)
+                    break;
+
+                if (pending.dx || pending.dy)
+                    pointerMotion(pending.dx, pending.dy, time);
+                if (pending.wheel)
+                    pointerAxis(0, pending.wheel * 15, time);
+                if (pending.hwheel)
+                    pointerAxis(1, -pending.hwheel * 15, time);
+                frame();
+                pending = { };
+                break;
+            case EV_REL:
+                if (event.code == REL_X)
+                    pending.dx += event.value;
+                else if (event.code == REL_Y)
+                    pending.dy += event.value;
+                else if (event.code == REL_WHEEL)
+                    pending.wheel += event.value;
+                else if (event.code == REL_HWHEEL)
+                    pending.hwheel += event.value;
+                break;
+            case EV_KEY:
+                // Repeats are generated here, the kernel's are ignored.
+                if (event.value == 2)
+                    break;
+                if (event.code >= BTN_MOUSE && event.code < BTN_JOYSTICK) {
+                    // Motion from the same frame happened before the button.
+                    if (pending.dx || pending.dy)
+                        pointerMotion(pending.dx, pending.dy, time);
+                    pending.dx = pending.dy = 0;
+                    pointerButton(event.code, !!event.value, time);
+                } else if (event.code < BTN_MISC || event.code >= KEY_OK)
+                    key(event.code, !!event.value, time);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+#endif
+
+void Input::pointerMotion(double dx, double dy, uint64_t time)
+{
+    auto* client = focus();
+    if (!client)
+        return;
+
+    auto size = client->inputSize();
+    auto& position = m_pointer.position;
+    position.first = std::max(0.0, std::min(position.first + dx, double(size.first) - 1));
+    position.second = std::max(0.0, std::min(position.second + dy, double(size.second) - 1));
+
+    m_pointer.motionPending = true;
+    m_pointer.motionTime = time;
+}
+
+void Input::pointerMotionAbsolute(double x, double y, uint64_t time)
+{
+    m_pointer.position = { x, y };
+    m_pointer.motionPending = true;
+    m_pointer.motionTime = time;
+}
+
+void Input::flushPointerMotion()
+{
+    if (!m_pointer.motionPending)
+        return;
+    m_pointer.motionPending = false;
+
+    auto* client = focus();
+    if (!client)
+        return;
+
+    int32_t x = m_pointer.position.first;
+    int32_t y = m_pointer.position.second;
+    client->pointerMoved(x, y);
+
+    struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_motion, eventTime(m_pointer.motionTime), x, y, m_pointer.button, m_pointer.state };
+    wpe_view_backend_dispatch_pointer_event(client->inputBackend(), &event);
+}
+
+void Input::pointerButton(uint32_t button, bool pressed, uint64_t time)
+{
+    flushPointerMotion();
+
+    if (button >= BTN_MOUSE)
+        button = button - BTN_MOUSE + 1;
+    else
+        button = 0;
+
+    m_pointer.button = pressed ? button : 0;
+    m_pointer.state = pressed;
+
+    auto* client = focus();
+    if (!client)
+        return;
+
+    struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_button, eventTime(time),
+        int(m_pointer.position.first), int(m_pointer.position.second), button, m_pointer.state };
+    wpe_view_backend_dispatch_pointer_event(client->inputBackend(), &event);
+}
+
+void Input::pointerAxis(uint32_t axis, int32_t value, uint64_t time)
+{
+    flushPointerMotion();
+
+    auto* client = focus();
+    if (!client)
+        return;
+
+    struct wpe_input_axis_event event = { wpe_input_axis_event_type_motion, eventTime(time),
+        int(m_pointer.position.first), int(m_pointer.position.second), axis, value };
+    wpe_view_backend_dispatch_axis_event(client->inputBackend(), &event);
+}
+
+void Input::key(uint32_t code, bool pressed, uint64_t time)
+{
+    if (!m_xkb.state)
+        return;
+
+    flushPointerMotion();
+
+    // Evdev codes are offset by 8 in XKB.
+    uint32_t key = code + 8;
+    uint32_t keyTime = eventTime(time);
+    dispatchKey(key, pressed, keyTime);
+
+    xkb_state_update_key(m_xkb.state, key, pressed ? XKB_KEY_DOWN : XKB_KEY_UP);
+    m_xkb.modifiers = 0;
+    auto component = static_cast<xkb_state_component>(XKB_STATE_MODS_DEPRESSED | XKB_STATE_MODS_LATCHED);
+    if (xkb_state_mod_index_is_active(m_xkb.state, m_xkb.control, component))
+        m_xkb.modifiers |= wpe_input_keyboard_modifier_control;
+    if (xkb_state_mod_index_is_active(m_xkb.state, m_xkb.alt, component))
+        m_xkb.modifiers |= wpe_input_keyboard_modifier_alt;
+    if (xkb_state_mod_index_is_active(m_xkb.state, m_xkb.shift, component))
+        m_xkb.modifiers |= wpe_input_keyboard_modifier_shift;
+
+    if (!pressed && m_keyRepeat.key() == key)
+        m_keyRepeat.stop();
+    else if (pressed && xkb_keymap_key_repeats(m_xkb.keymap, key))
+        m_keyRepeat.start(key, 1, keyTime);
+}
+
+void Input::dispatchKey(uint32_t key, bool pressed, uint32_t time)
+{
+    uint32_t keysym = xkb_state_key_get_one_sym(m_xkb.state, key);
+    uint32_t unicode = xkb_state_key_get_utf32(m_xkb.state, key);
+
+    if (m_xkb.composeState
+        && pressed
+        && xkb_compose_state_feed(m_xkb.composeState, keysym) == XKB_COMPOSE_FEED_ACCEPTED
+        && xkb_compose_state_get_status(m_xkb.composeState) == XKB_COMPOSE_COMPOSED)
+    {
+        keysym = xkb_compose_state_get_one_sym(m_xkb.composeState);
+        unicode = xkb_keysym_to_utf32(keysym);
+    }
+
+    auto* client = focus();
+    if (!client)
+        return;
+
+    struct wpe_input_keyboard_event event = { time, keysym, unicode, pressed, m_xkb.modifiers };
+    wpe_view_backend_dispatch_keyboard_event(client->inputBackend(), &event);
+}
+
+void Input::repeatKey(uint32_t key, uint32_t, uint32_t time)
+{
+    dispatchKey(key, true, time);
+}
+
+void Input::touch(wpe_input_touch_event_type type, int32_t slot, double x, double y, uint64_t time)
+{
+    if (slot < 0 || slot >= int32_t(m_touch.points.size()))
+        return;
+
+    auto& point = m_touch.points[slot];
+    if (type == wpe_input_touch_event_type_up)
+        point = { type, eventTime(time), slot, point.x, point.y };
+    else {
+        // Motion right after a down in the same frame is still reported as the down.
+        if (m_touch.changed[slot] && point.type == wpe_input_touch_event_type_down)
+            type = wpe_input_touch_event_type_down;
+        point = { type, eventTime(time), slot, int32_t(x), int32_t(y) };
+    }
+    m_touch.changed[slot] = true;
+}
+
+void Input::frame()
+{
+    flushPointerMotion();
+
+    auto* client = focus();
+    auto& points = m_touch.points;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (!m_touch.changed[i])
+            continue;
+        m_touch.changed[i] = false;
+
+        // All points carry their state for the whole frame by now.
+        if (client) {
+            struct wpe_input_touch_event event = { points.data(), points.size(), points[i].type, int32_t(i), points[i].time };
+            wpe_view_backend_dispatch_touch_event(client->inputBackend(), &event);
+        }
+
+        if (points[i].type == wpe_input_touch_event_type_up)
+            points[i] = { wpe_input_touch_event_type_null, 0, 0, 0, 0 };
+    }
+}
+
+} // namespace DRM
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_drm_input_h
+#define wpe_mesa_drm_input_h
+
+#include "key-repeat.h"
+#include <array>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include <wpe/wpe.h>
+
+struct libinput;
+struct udev;
+struct xkb_compose_state;
+struct xkb_compose_table;
+struct xkb_context;
+struct xkb_keymap;
+struct xkb_state;
+
+typedef struct _GSource GSource;
+
+namespace DRM {
+
+// Input for DRM views, read straight from the kernel as there is no compositor
+// to provide it. Devices are handled through libinput when it's available,
+// and read as raw evdev devices otherwise.
+//
+// Events are batched per kernel frame (SYN_REPORT): relative pointer motion
+// is coalesced into a single event, and touch points are dispatched once the
+// whole frame is known. Event times are the kernel timestamps, in
+// milliseconds of CLOCK_MONOTONIC, so that latency can be measured end to end.
+class Input : public Keyboard::KeyRepeat::Handler {
+public:
+    class Client {
+    public:
+        virtual struct wpe_view_backend* inputBackend() = 0;
+        virtual std::pair<uint32_t, uint32_t> inputSize() = 0;
+        virtual void pointerMoved(int32_t x, int32_t y) = 0;
+    };
+
+    static Input& singleton();
+
+    // Input goes to the most recently added client.
+    void addClient(Client&);
+    void removeClient(Client&);
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+    void dispatchLibinput();
+#else
+    void readEvdev(int fd);
+#endif
+
+private:
+    Input();
+    ~Input();
+
+    Client* focus() const { return m_clients.empty() ? nullptr : m_clients.back(); }
+
+    void pointerMotion(double dx, double dy, uint64_t time);
+    void pointerMotionAbsolute(double x, double y, uint64_t time);
+    void pointerButton(uint32_t button, bool pressed, uint64_t time);
+    void pointerAxis(uint32_t axis, int32_t value, uint64_t time);
+    void flushPointerMotion();
+
+    void key(uint32_t key, bool pressed, uint64_t time);
+    void dispatchKey(uint32_t key, bool pressed, uint32_t time);
+
+    // Keyboard::KeyRepeat::Handler
+    void repeatKey(uint32_t key, uint32_t state, uint32_t time) override;
+
+    void touch(wpe_input_touch_event_type, int32_t slot, double x, double y, uint64_t time);
+    void frame();
+
+    std::vector<Client*> m_clients;
+
+#if defined(WPE_MESA_DRM_LIBINPUT) && WPE_MESA_DRM_LIBINPUT
+    struct udev* m_udev { nullptr };
+    struct libinput* m_libinput { nullptr };
+    GSource* m_source { nullptr };
+#else
+    std::vector<std::pair<int, GSource*>> m_devices;
+#endif
+
+    struct {
+        std::pair<double, double> position { 0, 0 };
+        uint32_t button { 0 };
+        uint32_t state { 0 };
+        bool motionPending { false };
+        uint64_t motionTime { 0 };
+    } m_pointer;
+
+    struct {
+        std::array<struct wpe_input_touch_event_raw, 10> points;
+        std::array<bool, 10> changed;
+    } m_touch;
+
+    struct {
+        struct xkb_context* context { nullptr };
+        struct xkb_keymap* keymap { nullptr };
+        struct xkb_state* state { nullptr };
+        struct xkb_compose_table* composeTable { nullptr };
+        struct xkb_compose_state* composeState { nullptr };
+        uint32_t control { 0 };
+        uint32_t alt { 0 };
+        uint32_t shift { 0 };
+        uint8_t modifiers { 0 };
+    } m_xkb;
+
+    Keyboard::KeyRepeat m_keyRepeat { *this };
+};
+
+} // namespace DRM
+
+#endif // wpe_mesa_drm_input_h
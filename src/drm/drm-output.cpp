@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "drm-output.h"
+
+#include <wpe-mesa/view-backend-drm.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <xf86drm.h>
+
+namespace DRM {
+
+static const char* connectorTypeName(uint32_t type)
+{
+    switch (type) {
+    case DRM_MODE_CONNECTOR_VGA:
+        return "VGA";
+    case DRM_MODE_CONNECTOR_DVII:
+        return "DVI-I";
+    case DRM_MODE_CONNECTOR_DVID:
+        return "DVI-D";
+    case DRM_MODE_CONNECTOR_DVIA:
+        return "DVI-A";
+    case DRM_MODE_CONNECTOR_Composite:
+        return "Composite";
+    case DRM_MODE_CONNECTOR_SVIDEO:
+        return "SVIDEO";
+    case DRM_MODE_CONNECTOR_LVDS:
+        return "LVDS";
+    case DRM_MODE_CONNECTOR_Component:
+        return "Component";
+    case DRM_MODE_CONNECTOR_9PinDIN:
+        return "DIN";
+    case DRM_MODE_CONNECTOR_DisplayPort:
+        return "DP";
+    case DRM_MODE_CONNECTOR_HDMIA:
+        return "HDMI-A";
+    case DRM_MODE_CONNECTOR_HDMIB:
+        return "HDMI-B";
+    case DRM_MODE_CONNECTOR_TV:
+        return "TV";
+    case DRM_MODE_CONNECTOR_eDP:
+        return "eDP";
+    case DRM_MODE_CONNECTOR_VIRTUAL:
+        return "Virtual";
+    case DRM_MODE_CONNECTOR_DSI:
+        return "DSI";
+    case DRM_MODE_CONNECTOR_DPI:
+        return "DPI";
+    default:
+        return "Unknown";
+    }
+}
+
+bool probeConnector(int fd, uint32_t connectorId, const std::vector<uint32_t>& crtcs, ConnectorInfo& info)
+{
+    drmModeConnector* connector = drmModeGetConnector(fd, connectorId);
+    if (!connector)
+        return false;
+
+    info = ConnectorInfo();
+    info.id = connector->connector_id;
+    info.name = std::string(connectorTypeName(connector->connector_type)) + "-" + std::to_string(connector->connector_type_id);
+    info.connected = connector->connection == DRM_MODE_CONNECTED;
+    info.modes.assign(connector->modes, connector->modes + connector->count_modes);
+
+    for (int i = 0; i < connector->count_encoders; ++i) {
+        drmModeEncoder* encoder = drmModeGetEncoder(fd, connector->encoders[i]);
+        if (!encoder)
+            continue;
+
+        info.possibleCrtcs |= encoder->possible_crtcs;
+        if (encoder->encoder_id == connector->encoder_id && encoder->crtc_id)
+            info.crtcId = encoder->crtc_id;
+
+        drmModeFreeEncoder(encoder);
+    }
+
+    for (int i = 0; i < connector->count_props; ++i) {
+        drmModePropertyRes* property = drmModeGetProperty(fd, connector->props[i]);
+        if (!property)
+            continue;
+        if (!std::strcmp(property->name, "vrr_capable"))
+            info.vrrCapable = !!connector->prop_values[i];
+        drmModeFreeProperty(property);
+    }
+
+    if (!info.crtcId) {
+        for (size_t i = 0; i < crtcs.size(); ++i) {
+            if (info.possibleCrtcs & (1 << i)) {
+                info.crtcId = crtcs[i];
+                break;
+            }
+        }
+    }
+
+    drmModeFreeConnector(connector);
+    return true;
+}
+
+ProbeResult probeOutputs(int fd)
+{
+    ProbeResult result;
+
+    drmModeRes* resources = drmModeGetResources(fd);
+    if (!resources)
+        return result;
+
+    result.crtcs.assign(resources->crtcs, resources->crtcs + resources->count_crtcs);
+
+    for (int i = 0; i < resources->count_connectors; ++i) {
+        ConnectorInfo info;
+        if (probeConnector(fd, resources->connectors[i], result.crtcs, info))
+            result.connectors.push_back(std::move(info));
+    }
+
+    drmModeFreeResources(resources);
+    return result;
+}
+
+// Calls the functor for every entry of a "value" or "name:value,name:value"
+// list, with an empty name for values that apply to all outputs.
+template<typename F>
+static void parsePerConnectorList(const char* value, F&& functor)
+{
+    std::string list(value);
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+
+        std::string entry = list.substr(start, end - start);
+        size_t separator = entry.rfind(':');
+        if (separator == std::string::npos)
+            functor(std::string(), entry);
+        else
+            functor(entry.substr(0, separator), entry.substr(separator + 1));
+        start = end + 1;
+    }
+}
+
+static void parseConnectorList(const char* value, std::vector<std::string>& connectors)
+{
+    std::string list(value);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            connectors.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+static OutputPolicy& policyStorage()
+{
+    static OutputPolicy policy;
+    static bool initialized = false;
+    if (initialized)
+        return policy;
+    initialized = true;
+
+    if (const char* connector = std::getenv("WPE_DRM_CONNECTOR"))
+        parseConnectorList(connector, policy.connectors);
+
+    const char* mode = std::getenv("WPE_DRM_MODE");
+    if (mode && !policy.parseMode(mode))
+        fprintf(stderr, "DRM: ignoring invalid mode specification '%s'\n", mode);
+
+    if (const char* vrr = std::getenv("WPE_DRM_VRR"))
+        policy.adaptiveSync = !std::strcmp(vrr, "1");
+
+    if (const char* rotation = std::getenv("WPE_DRM_ROTATION")) {
+        parsePerConnectorList(rotation,
+            [](const std::string& connector, const std::string& value) {
+                OutputTransform transform = policyStorage().transformFor(connector);
+                transform.rotation = std::strtoul(value.c_str(), nullptr, 10);
+                OutputPolicy::setTransform(connector.c_str(), transform);
+            });
+    }
+
+    if (const char* renderSize = std::getenv("WPE_DRM_RENDER_SIZE")) {
+        parsePerConnectorList(renderSize,
+            [](const std::string& connector, const std::string& value) {
+                OutputTransform transform = policyStorage().transformFor(connector);
+                if (std::sscanf(value.c_str(), "%ux%u", &transform.renderWidth, &transform.renderHeight) != 2) {
+                    transform.renderWidth = transform.renderHeight = 0;
+                    transform.renderScale = std::strtod(value.c_str(), nullptr);
+                }
+                OutputPolicy::setTransform(connector.c_str(), transform);
+            });
+    }
+
+    return policy;
+}
+
+const OutputPolicy& OutputPolicy::current()
+{
+    return policyStorage();
+}
+
+void OutputPolicy::set(const char* connector, const char* mode)
+{
+    auto& policy = policyStorage();
+
+    policy.connectors.clear();
+    if (connector)
+        parseConnectorList(connector, policy.connectors);
+
+    policy.rule = ModeRule::Largest;
+    if (mode && !policy.parseMode(mode))
+        fprintf(stderr, "DRM: ignoring invalid mode specification '%s'\n", mode);
+}
+
+void OutputPolicy::setTransform(const char* connector, const OutputTransform& transform)
+{
+    auto& transforms = policyStorage().transforms;
+    std::string name(connector ? connector : "");
+
+    switch (transform.rotation) {
+    case 0:
+    case 90:
+    case 180:
+    case 270:
+        break;
+    default:
+        fprintf(stderr, "DRM: ignoring unsupported rotation of %u degrees\n", transform.rotation);
+        return;
+    }
+
+    for (auto& entry : transforms) {
+        if (entry.first == name) {
+            entry.second = transform;
+            return;
+        }
+    }
+    transforms.push_back({ name, transform });
+}
+
+void OutputPolicy::setAdaptiveSync(bool enabled)
+{
+    policyStorage().adaptiveSync = enabled;
+}
+
+OutputTransform OutputPolicy::transformFor(const std::string& connector) const
+{
+    OutputTransform transform;
+    for (auto& entry : transforms) {
+        if (entry.first == connector)
+            return entry.second;
+        if (entry.first.empty())
+            transform = entry.second;
+    }
+    return transform;
+}
+
+std::pair<uint32_t, uint32_t> OutputTransform::logicalSize(const drmModeModeInfo& mode) const
+{
+    if (renderWidth && renderHeight)
+        return { renderWidth, renderHeight };
+
+    std::pair<uint32_t, uint32_t> size = { mode.hdisplay, mode.vdisplay };
+    if (rotation == 90 || rotation == 270)
+        std::swap(size.first, size.second);
+
+    if (renderScale > 0 && renderScale < 1) {
+        size.first = std::max<uint32_t>(1, size.first * renderScale);
+        size.second = std::max<uint32_t>(1, size.second * renderScale);
+    }
+    return size;
+}
+
+bool OutputPolicy::parseMode(const char* mode)
+{
+    if (!std::strcmp(mode, "preferred")) {
+        rule = ModeRule::Preferred;
+        return true;
+    }
+
+    if (!std::strncmp(mode, "max-refresh", 11)) {
+        rule = ModeRule::MaxRefresh;
+        pixelBudget = 0;
+        if (mode[11] == '\0')
+            return true;
+
+        uint32_t budgetWidth, budgetHeight;
+        if (std::sscanf(mode + 11, ":%ux%u", &budgetWidth, &budgetHeight) != 2)
+            return false;
+        pixelBudget = uint64_t(budgetWidth) * budgetHeight;
+        return true;
+    }
+
+    pixelBudget = 0;
+    uint32_t modeWidth = 0, modeHeight = 0, modeRefresh = 0;
+    int matched = std::sscanf(mode, "%ux%u@%u", &modeWidth, &modeHeight, &modeRefresh);
+    if (matched < 2 || !modeWidth || !modeHeight)
+        return false;
+
+    rule = ModeRule::Exact;
+    width = modeWidth;
+    height = modeHeight;
+    refresh = matched == 3 ? modeRefresh : 0;
+    return true;
+}
+
+uint32_t modeRefresh(const drmModeModeInfo& mode)
+{
+    if (!mode.htotal || !mode.vtotal)
+        return mode.vrefresh * 1000;
+
+    uint64_t refresh = (uint64_t(mode.clock) * 1000000) / (uint64_t(mode.htotal) * mode.vtotal);
+    if (mode.flags & DRM_MODE_FLAG_INTERLACE)
+        refresh *= 2;
+    if (mode.flags & DRM_MODE_FLAG_DBLSCAN)
+        refresh /= 2;
+    if (mode.vscan > 1)
+        refresh /= mode.vscan;
+    return refresh;
+}
+
+static bool sameTimings(const drmModeModeInfo& a, const drmModeModeInfo& b)
+{
+    return a.clock == b.clock
+        && a.hdisplay == b.hdisplay && a.hsync_start == b.hsync_start && a.hsync_end == b.hsync_end
+        && a.htotal == b.htotal && a.hskew == b.hskew
+        && a.vdisplay == b.vdisplay && a.vsync_start == b.vsync_start && a.vsync_end == b.vsync_end
+        && a.vtotal == b.vtotal && a.vscan == b.vscan
+        && a.flags == b.flags;
+}
+
+bool isOutputActive(int fd, uint32_t connectorId, uint32_t crtcId, const drmModeModeInfo& mode)
+{
+    // Only the current state is needed, so avoid a forced probe of the connector.
+    drmModeConnector* connector = drmModeGetConnectorCurrent(fd, connectorId);
+    if (!connector)
+        return false;
+
+    uint32_t encoderId = connector->encoder_id;
+    drmModeFreeConnector(connector);
+    if (!encoderId)
+        return false;
+
+    drmModeEncoder* encoder = drmModeGetEncoder(fd, encoderId);
+    if (!encoder)
+        return false;
+
+    bool driven = encoder->crtc_id == crtcId;
+    drmModeFreeEncoder(encoder);
+    if (!driven)
+        return false;
+
+    drmModeCrtc* crtc = drmModeGetCrtc(fd, crtcId);
+    if (!crtc)
+        return false;
+
+    bool active = crtc->mode_valid && crtc->buffer_id && sameTimings(crtc->mode, mode);
+    drmModeFreeCrtc(crtc);
+    return active;
+}
+
+static uint64_t modeArea(const drmModeModeInfo& mode)
+{
+    return uint64_t(mode.hdisplay) * mode.vdisplay;
+}
+
+static const drmModeModeInfo* largestMode(const std::vector<drmModeModeInfo>& modes)
+{
+    const drmModeModeInfo* selected = nullptr;
+    for (auto& mode : modes) {
+        if (!selected || modeArea(mode) > modeArea(*selected)
+            || (modeArea(mode) == modeArea(*selected) && modeRefresh(mode) > modeRefresh(*selected)))
+            selected = &mode;
+    }
+    return selected;
+}
+
+static const drmModeModeInfo* preferredMode(const std::vector<drmModeModeInfo>& modes)
+{
+    for (auto& mode : modes) {
+        if (mode.type & DRM_MODE_TYPE_PREFERRED)
+            return &mode;
+    }
+    return largestMode(modes);
+}
+
+const drmModeModeInfo* selectMode(const ConnectorInfo& connector, const OutputPolicy& policy)
+{
+    auto& modes = connector.modes;
+    const drmModeModeInfo* selected = nullptr;
+
+    switch (policy.rule) {
+    case OutputPolicy::ModeRule::Largest:
+        return largestMode(modes);
+    case OutputPolicy::ModeRule::Preferred:
+        return preferredMode(modes);
+    case OutputPolicy::ModeRule::Exact:
+        for (auto& mode : modes) {
+            if (mode.hdisplay != policy.width || mode.vdisplay != policy.height)
+                continue;
+            // Match the requested rate to the nearest Hz, so that 60 also picks 59.94.
+            if (policy.refresh && (modeRefresh(mode) + 500) / 1000 != policy.refresh)
+                continue;
+            if (!selected || modeRefresh(mode) > modeRefresh(*selected))
+                selected = &mode;
+        }
+        break;
+    case OutputPolicy::ModeRule::MaxRefresh:
+        for (auto& mode : modes) {
+            if (policy.pixelBudget && modeArea(mode) > policy.pixelBudget)
+                continue;
+            if (!selected || modeRefresh(mode) > modeRefresh(*selected)
+                || (modeRefresh(mode) == modeRefresh(*selected) && modeArea(mode) > modeArea(*selected)))
+                selected = &mode;
+        }
+        break;
+    }
+
+    if (!selected) {
+        fprintf(stderr, "DRM: no mode matches the requested policy, using the preferred mode\n");
+        selected = preferredMode(modes);
+    }
+    return selected;
+}
+
+OutputSelection selectOutput(const ProbeResult& probe, const OutputPolicy& policy, const std::vector<uint32_t>& claimedConnectors)
+{
+    auto isUsable = [&claimedConnectors](const ConnectorInfo& connector) {
+        return connector.connected && !connector.modes.empty() && connector.possibleCrtcs
+            && std::find(claimedConnectors.begin(), claimedConnectors.end(), connector.id) == claimedConnectors.end();
+    };
+
+    OutputSelection selection;
+    for (auto& name : policy.connectors) {
+        for (auto& connector : probe.connectors) {
+            if (connector.name == name && isUsable(connector)) {
+                selection.connector = &connector;
+                break;
+            }
+        }
+        if (selection.connector)
+            break;
+    }
+
+    if (!selection.connector) {
+        if (!policy.connectors.empty())
+            fprintf(stderr, "DRM: none of the requested connectors is available, using the first free one\n");
+
+        for (auto& connector : probe.connectors) {
+            if (isUsable(connector)) {
+                selection.connector = &connector;
+                break;
+            }
+        }
+    }
+
+    if (selection.connector)
+        selection.mode = selectMode(*selection.connector, policy);
+    return selection;
+}
+
+} // namespace DRM
+
+extern "C" {
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_drm_set_output_policy(const char* connector, const char* mode)
+{
+    DRM::OutputPolicy::set(connector, mode);
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_drm_set_adaptive_sync(int enabled)
+{
+    DRM::OutputPolicy::setAdaptiveSync(!!enabled);
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_drm_set_output_transform(const char* connector, uint32_t rotation, uint32_t render_width, uint32_t render_height)
+{
+    DRM::OutputTransform transform;
+    transform.rotation = rotation;
+    transform.renderWidth = render_width;
+    transform.renderHeight = render_height;
+    DRM::OutputPolicy::setTransform(connector, transform);
+}
+
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_drm_output_h
+#define wpe_mesa_drm_output_h
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <xf86drmMode.h>
+
+namespace DRM {
+
+struct ConnectorInfo {
+    uint32_t id { 0 };
+    std::string name;
+    bool connected { false };
+
+    // The CRTC currently driving this connector, or the first compatible one.
+    uint32_t crtcId { 0 };
+    // Bitmask over ProbeResult::crtcs, accumulated from all usable encoders.
+    uint32_t possibleCrtcs { 0 };
+    // Whether the sink and driver support variable refresh rates.
+    bool vrrCapable { false };
+
+    std::vector<drmModeModeInfo> modes;
+};
+
+struct ProbeResult {
+    std::vector<uint32_t> crtcs;
+    std::vector<ConnectorInfo> connectors;
+};
+
+// Walks every connector and encoder, which is slow on some drivers. The
+// result is kept by DRM::Device and shared by all outputs.
+ProbeResult probeOutputs(int fd);
+
+// Re-queries a single connector, e.g. after a hotplug event naming it.
+bool probeConnector(int fd, uint32_t connectorId, const std::vector<uint32_t>& crtcs, ConnectorInfo&);
+
+// Selection policy, taken from WPE_DRM_CONNECTOR and WPE_DRM_MODE unless
+// set through wpe_mesa_view_backend_drm_set_output_policy(). The connector
+// may be a comma-separated list, in which case each new view binds to the
+// first listed connector that is not yet in use. WPE_DRM_MODE accepts one of:
+//   preferred              the mode flagged DRM_MODE_TYPE_PREFERRED
+//   <W>x<H>[@<Hz>]         an exact size, optionally at a given refresh
+//   max-refresh[:<W>x<H>]  the highest refresh rate within a pixel budget
+// Without a policy the largest mode is used, preferring higher refresh rates.
+//
+// Outputs can also be rotated and scaled on the primary plane, configured
+// through WPE_DRM_ROTATION (0, 90, 180 or 270 degrees counter-clockwise) and
+// WPE_DRM_RENDER_SIZE (<W>x<H>, or a scale factor such as 0.5), or through
+// wpe_mesa_view_backend_drm_set_output_transform(). Both variables take
+// either a single value for all outputs or a list like HDMI-A-1:90,DP-1:0.
+struct OutputTransform {
+    uint32_t rotation { 0 };
+    uint32_t renderWidth { 0 };
+    uint32_t renderHeight { 0 };
+    double renderScale { 0 };
+
+    bool isIdentity() const { return !rotation && !renderWidth && !renderHeight && !renderScale; }
+
+    // The size WebKit renders at, for an output in the given mode.
+    std::pair<uint32_t, uint32_t> logicalSize(const drmModeModeInfo&) const;
+};
+
+struct OutputPolicy {
+    enum class ModeRule {
+        Largest,
+        Preferred,
+        Exact,
+        MaxRefresh,
+    };
+
+    std::vector<std::string> connectors;
+    ModeRule rule { ModeRule::Largest };
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    uint32_t refresh { 0 };
+    uint64_t pixelBudget { 0 };
+
+    // Entries with an empty connector name apply to every output.
+    std::vector<std::pair<std::string, OutputTransform>> transforms;
+
+    // Opt-in through WPE_DRM_VRR=1. Only used on VRR-capable connectors
+    // driven through atomic commits; other outputs keep a fixed refresh.
+    bool adaptiveSync { false };
+
+    static const OutputPolicy& current();
+    static void set(const char* connector, const char* mode);
+    static void setTransform(const char* connector, const OutputTransform&);
+    static void setAdaptiveSync(bool);
+
+    bool parseMode(const char*);
+    OutputTransform transformFor(const std::string& connector) const;
+};
+
+struct OutputSelection {
+    const ConnectorInfo* connector { nullptr };
+    const drmModeModeInfo* mode { nullptr };
+};
+
+// Connectors listed in the last argument are already bound to other views
+// and are skipped.
+OutputSelection selectOutput(const ProbeResult&, const OutputPolicy&, const std::vector<uint32_t>&);
+const drmModeModeInfo* selectMode(const ConnectorInfo&, const OutputPolicy&);
+
+// Refresh rate of a mode in mHz, computed from the timings rather than
+// the rounded vrefresh field.
+uint32_t modeRefresh(const drmModeModeInfo&);
+
+// Whether the connector is already lit by the CRTC with the given mode, e.g.
+// by the bootloader or a splash screen, so that the modeset can be skipped.
+bool isOutputActive(int fd, uint32_t connectorId, uint32_t crtcId, const drmModeModeInfo&);
+
+} // namespace DRM
+
+#endif // wpe_mesa_drm_output_h
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "drm-software.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <glib.h>
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace DRM {
+
+// Dumb buffers are usually mapped write-combined, so rows are written with
+// non-temporal stores that bypass the cache instead of polluting it.
+static void copyRow(uint8_t* target, const uint8_t* source, size_t size)
+{
+#if defined(__SSE2__)
+    while (size && (uintptr_t(target) & 15)) {
+        *target++ = *source++;
+        --size;
+    }
+
+    for (; size >= 64; size -= 64, source += 64, target += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(target), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(target + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(target + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(target + 48), d);
+    }
+#endif
+    std::memcpy(target, source, size);
+}
+
+static void syncBuffer(int fd, uint64_t flags)
+{
+    struct dma_buf_sync sync = { flags };
+    // Plain shared memory isn't a dma-buf, and needs no synchronization.
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 && (errno == EINTR || errno == EAGAIN)) { }
+}
+
+void SoftwareScanout::Rect::unite(const Rect& other)
+{
+    if (other.isEmpty())
+        return;
+    if (isEmpty()) {
+        *this = other;
+        return;
+    }
+
+    x1 = std::min(x1, other.x1);
+    y1 = std::min(y1, other.y1);
+    x2 = std::max(x2, other.x2);
+    y2 = std::max(y2, other.y2);
+}
+
+SoftwareScanout::SoftwareScanout(Device& device)
+    : m_device(device)
+{
+}
+
+SoftwareScanout::~SoftwareScanout()
+{
+    for (auto& it : m_buffers)
+        releaseBuffer(it.second);
+    m_buffers.clear();
+
+    for (auto& slot : m_slots)
+        destroySlot(slot);
+    for (auto& slot : m_retiredSlots)
+        destroySlot(slot);
+}
+
+bool SoftwareScanout::importBuffer(uint32_t handle, int fd, uint32_t width, uint32_t height, uint32_t stride)
+{
+    auto it = m_buffers.find(handle);
+    if (it != m_buffers.end()) {
+        releaseBuffer(it->second);
+        m_buffers.erase(it);
+    }
+
+    size_t size = size_t(stride) * height;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "SoftwareScanout: failed to map buffer %u: %s\n", handle, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    m_buffers.insert({ handle, { fd, data, size, width, height, stride } });
+    return true;
+}
+
+void SoftwareScanout::releaseBuffer(Buffer& buffer)
+{
+    munmap(buffer.data, buffer.size);
+    close(buffer.fd);
+}
+
+bool SoftwareScanout::ensureSlots(uint32_t width, uint32_t height)
+{
+    if (width == m_width && height == m_height)
+        return true;
+
+    // The size only changes once every slot is allocated, so a failure
+    // leaves the slots of the previous size in place and is retried with
+    // the next frame.
+    Slot slots[s_slotCount];
+    for (auto& slot : slots) {
+        bool allocated = m_device.createDumbBuffer(width, height, slot.buffer);
+        if (allocated && drmModeAddFB(m_device.fd(), width, height, 24, 32, slot.buffer.pitch, slot.buffer.handle, &slot.fbId)) {
+            fprintf(stderr, "SoftwareScanout: failed to add FB: %s\n", strerror(errno));
+            allocated = false;
+        }
+        if (!allocated) {
+            for (auto& partial : slots)
+                destroySlot(partial);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < int(s_slotCount); ++i) {
+        if (m_slots[i].buffer.handle) {
+            if (i == m_currentSlot || i == m_pendingSlot)
+                m_retiredSlots.push_back(m_slots[i]);
+            else
+                destroySlot(m_slots[i]);
+        }
+        m_slots[i] = slots[i];
+    }
+    m_currentSlot = m_pendingSlot = -1;
+
+    m_width = width;
+    m_height = height;
+    m_shadow.assign(size_t(width) * height * 4, 0);
+    m_damageHistory.clear();
+    return true;
+}
+
+void SoftwareScanout::destroySlot(Slot& slot)
+{
+    if (slot.fbId)
+        drmModeRmFB(m_device.fd(), slot.fbId);
+    m_device.destroyDumbBuffer(slot.buffer);
+    slot = Slot();
+}
+
+SoftwareScanout::Rect SoftwareScanout::updateShadow(const Buffer& buffer)
+{
+    Rect damage = { m_width, m_height, 0, 0 };
+    size_t rowSize = size_t(m_width) * 4;
+
+    syncBuffer(buffer.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    for (uint32_t y = 0; y < m_height; ++y) {
+        const uint8_t* source = static_cast<const uint8_t*>(buffer.data) + size_t(y) * buffer.stride;
+        uint8_t* shadow = m_shadow.data() + y * rowSize;
+        if (!std::memcmp(source, shadow, rowSize))
+            continue;
+
+        // Narrow down the changed span, in 16-pixel steps.
+        size_t first = 0;
+        while (first + 64 <= rowSize && !std::memcmp(source + first, shadow + first, 64))
+            first += 64;
+        size_t last = rowSize;
+        while (last >= first + 64 && !std::memcmp(source + last - 64, shadow + last - 64, 64))
+            last -= 64;
+
+        std::memcpy(shadow + first, source + first, last - first);
+        damage.unite({ uint32_t(first / 4), y, uint32_t(last / 4), y + 1 });
+    }
+    syncBuffer(buffer.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+    return damage;
+}
+
+bool SoftwareScanout::update(uint32_t handle, Target& target)
+{
+    auto it = m_buffers.find(handle);
+    if (it == m_buffers.end())
+        return false;
+
+    auto& buffer = it->second;
+    if (!ensureSlots(buffer.width, buffer.height))
+        return false;
+
+    int64_t start = g_get_monotonic_time();
+
+    ++m_serial;
+    m_damageHistory.push_back(updateShadow(buffer));
+    if (m_damageHistory.size() > s_slotCount)
+        m_damageHistory.pop_front();
+
+    int index = 0;
+    while (index == m_currentSlot || index == m_pendingSlot)
+        ++index;
+    auto& slot = m_slots[index];
+
+    // The slot needs every change made after the frame it holds.
+    Rect damage = { 0, 0, m_width, m_height };
+    uint64_t age = m_serial - slot.serial;
+    if (slot.serial && age <= m_damageHistory.size()) {
+        damage = { m_width, m_height, 0, 0 };
+        for (size_t i = m_damageHistory.size() - age; i < m_damageHistory.size(); ++i)
+            damage.unite(m_damageHistory[i]);
+    }
+
+    size_t rowSize = size_t(m_width) * 4;
+    if (!damage.isEmpty()) {
+        size_t offset = size_t(damage.x1) * 4;
+        size_t size = size_t(damage.x2 - damage.x1) * 4;
+        auto* data = static_cast<uint8_t*>(slot.buffer.data);
+        for (uint32_t y = damage.y1; y < damage.y2; ++y)
+            copyRow(data + size_t(y) * slot.buffer.pitch + offset, m_shadow.data() + y * rowSize + offset, size);
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+        m_stats.bytesCopied += size * (damage.y2 - damage.y1);
+    }
+
+    target = { slot.fbId, m_width, m_height, { 0, 0, 0, 0 } };
+
+    // What the display has to refetch is everything changed since the frame
+    // currently scanned out, which isn't necessarily the previous one.
+    if (m_currentSlot != -1 && m_slots[m_currentSlot].serial) {
+        uint64_t screenAge = m_serial - m_slots[m_currentSlot].serial;
+        if (screenAge <= m_damageHistory.size()) {
+            Rect screenDamage = { m_width, m_height, 0, 0 };
+            for (size_t i = m_damageHistory.size() - screenAge; i < m_damageHistory.size(); ++i)
+                screenDamage.unite(m_damageHistory[i]);
+            if (!screenDamage.isEmpty())
+                target.damage = { screenDamage.x1, screenDamage.y1, screenDamage.x2 - screenDamage.x1, screenDamage.y2 - screenDamage.y1 };
+        }
+    }
+
+    slot.serial = m_serial;
+    m_pendingSlot = index;
+    ++m_stats.frames;
+    m_stats.copyTime += g_get_monotonic_time() - start;
+    return true;
+}
+
+void SoftwareScanout::presented()
+{
+    if (m_pendingSlot == -1)
+        return;
+
+    m_currentSlot = m_pendingSlot;
+    m_pendingSlot = -1;
+
+    for (auto& slot : m_retiredSlots)
+        destroySlot(slot);
+    m_retiredSlots.clear();
+}
+
+bool SoftwareScanout::currentTarget(Target& target) const
+{
+    if (m_currentSlot == -1)
+        return false;
+
+    target = { m_slots[m_currentSlot].fbId, m_width, m_height, { 0, 0, 0, 0 } };
+    return true;
+}
+
+void SoftwareScanout::discard()
+{
+    m_pendingSlot = -1;
+}
+
+} // namespace DRM
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_drm_software_h
+#define wpe_mesa_drm_software_h
+
+#include "drm-device.h"
+#include <deque>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace DRM {
+
+// CPU presentation path, for devices that can't scan out the renderer's
+// buffers directly: boards without a usable GPU, or vkms. The renderer's
+// buffers are mapped, and every frame is copied into one of a small ring of
+// dumb buffers which is then flipped. Only the area that changed since a dumb
+// buffer was last written is copied into it.
+class SoftwareScanout {
+public:
+    struct Target {
+        uint32_t fbId;
+        uint32_t width;
+        uint32_t height;
+
+        // Area that changed since the frame on screen, empty when unknown.
+        struct {
+            uint32_t x, y, width, height;
+        } damage;
+    };
+
+    struct Stats {
+        uint64_t frames { 0 };
+        uint64_t bytesCopied { 0 };
+        uint64_t copyTime { 0 };
+    };
+
+    SoftwareScanout(Device&);
+    ~SoftwareScanout();
+
+    // The fd is kept, as dma-bufs need it to synchronize CPU access.
+    bool importBuffer(uint32_t handle, int fd, uint32_t width, uint32_t height, uint32_t stride);
+    bool hasBuffer(uint32_t handle) const { return m_buffers.count(handle); }
+
+    // Copies the buffer into a free dumb buffer, which becomes the pending one.
+    bool update(uint32_t handle, Target&);
+    // The pending dumb buffer is now on screen, or won't be after all.
+    void presented();
+    void discard();
+
+    // The dumb buffer on screen, e.g. to show it again after a modeset.
+    bool currentTarget(Target&) const;
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    struct Buffer {
+        int fd;
+        void* data;
+        size_t size;
+        uint32_t width;
+        uint32_t height;
+        uint32_t stride;
+    };
+
+    struct Slot {
+        Device::DumbBuffer buffer;
+        uint32_t fbId { 0 };
+        // Serial of the frame last copied in, 0 if never written.
+        uint64_t serial { 0 };
+    };
+
+    struct Rect {
+        uint32_t x1, y1, x2, y2;
+
+        bool isEmpty() const { return x1 >= x2 || y1 >= y2; }
+        void unite(const Rect&);
+    };
+
+    void releaseBuffer(Buffer&);
+    bool ensureSlots(uint32_t width, uint32_t height);
+    void destroySlot(Slot&);
+    Rect updateShadow(const Buffer&);
+
+    Device& m_device;
+    std::unordered_map<uint32_t, Buffer> m_buffers;
+
+    // Copy of the latest frame, in cached memory. Comparing against it finds
+    // the damaged area without ever reading back from the dumb buffers.
+    std::vector<uint8_t> m_shadow;
+    uint32_t m_width { 0 };
+    uint32_t m_height { 0 };
+
+    static const size_t s_slotCount = 3;
+    Slot m_slots[s_slotCount];
+    // Slots of a previous size, destroyed once they are off screen.
+    std::vector<Slot> m_retiredSlots;
+    int m_pendingSlot { -1 };
+    int m_currentSlot { -1 };
+
+    // Damage of the most recent frames, newest last.
+    uint64_t m_serial { 0 };
+    std::deque<Rect> m_damageHistory;
+
+    Stats m_stats;
+};
+
+} // namespace DRM
+
+#endif // wpe_mesa_drm_software_h
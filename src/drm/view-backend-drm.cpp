@@ -26,115 +26,140 @@
 
 #include "view-backend-drm.h"
 
+#include <wpe-mesa/view-backend-drm.h>
+
+#include "drm-device.h"
+#include "drm-input.h"
+#include "drm-software.h"
 #include "ipc.h"
 #include "ipc-gbm.h"
-#include <cassert>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <errno.h>
-#include <fcntl.h>
 #include <gbm.h>
 #include <glib.h>
+#include <inttypes.h>
+#include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 namespace DRM {
 
-template<typename T>
-struct Cleanup {
-    ~Cleanup()
-    {
-        if (valid)
-            cleanup();
-    }
-
-    T cleanup;
-    bool valid;
-};
+class ViewBackend;
 
-template<typename T>
-auto defer(T&& cleanup) -> Cleanup<T>
+static std::unordered_map<struct wpe_view_backend*, ViewBackend*>& viewBackends()
 {
-    return Cleanup<T>{ std::forward<T>(cleanup), true };
+    static std::unordered_map<struct wpe_view_backend*, ViewBackend*> map;
+    return map;
 }
 
-class EventSource {
+class ViewBackend : public IPC::Host::Handler, public Device::Client, public Input::Client {
 public:
-    static GSourceFuncs sourceFuncs;
-
-    GSource source;
-    GPollFD pfd;
-
-    int drmFD;
-    drmEventContext eventContext;
-};
+    ViewBackend(struct wpe_view_backend*);
+    virtual ~ViewBackend();
 
-GSourceFuncs EventSource::sourceFuncs = {
-    nullptr, // prepare
-    // check
-    [](GSource* base) -> gboolean
-    {
-        auto* source = reinterpret_cast<EventSource*>(base);
-        return !!source->pfd.revents;
-    },
-    // dispatch
-    [](GSource* base, GSourceFunc, gpointer) -> gboolean
-    {
-        auto* source = reinterpret_cast<EventSource*>(base);
+    // IPC::Host::Handler
+    void handleFd(int) override;
+    void handleMessage(char*, size_t) override;
 
-        if (source->pfd.revents & G_IO_IN)
-            drmHandleEvent(source->drmFD, &source->eventContext);
+    // Device::Client
+    void pageFlipped(unsigned, unsigned, unsigned) override;
+    void outputsChanged() override;
 
-        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
-            return FALSE;
+    // Input::Client
+    struct wpe_view_backend* inputBackend() override { return backend; }
+    std::pair<uint32_t, uint32_t> inputSize() override { return m_drm.size; }
+    void pointerMoved(int32_t x, int32_t y) override { moveCursor(x, y); }
 
-        source->pfd.revents = 0;
-        return TRUE;
-    },
-    nullptr, // finalize
-    nullptr, // closure_callback
-    nullptr, // closure_marshall
-};
+    struct Framebuffer {
+        struct gbm_bo* bo;
+        uint32_t id;
+        uint32_t width;
+        uint32_t height;
+    };
 
-class ViewBackend;
+    bool schedulePageFlip(uint32_t);
+    int commitAtomic(const Framebuffer&, uint32_t flags, const struct drm_mode_rect* damage = nullptr);
+    void configureTransform();
+    void configureAdaptiveSync();
+    std::pair<uint16_t, uint16_t> logicalSize() const;
+    void releaseBuffer(uint32_t);
+    void dropFrame(uint32_t);
+    void dropBuffer(uint32_t);
 
-struct PageFlipHandlerData {
-    ViewBackend* backend;
-    std::pair<bool, uint32_t> nextFB;
-    std::pair<bool, uint32_t> lockedFB;
-};
+    void setCursorImage(const uint32_t*, uint32_t width, uint32_t height, uint32_t stride, int32_t hotspotX, int32_t hotspotY);
+    void moveCursor(int32_t x, int32_t y);
+    void updateCursor();
+    void writeCursorImage();
+    std::pair<int32_t, int32_t> cursorHotspot() const;
+    std::pair<int32_t, int32_t> outputPosition(int32_t x, int32_t y) const;
 
-class ViewBackend : public IPC::Host::Handler {
-public:
-    ViewBackend(struct wpe_view_backend*);
-    virtual ~ViewBackend();
-
-    // IPC::Host::Handler
-    void handleFd(int) override;
-    void handleMessage(char*, size_t) override;
+    static ViewBackend* fromBackend(struct wpe_view_backend*);
 
     struct wpe_view_backend* backend;
+    Device& m_device;
 
     struct {
-        int fd { -1 };
-        drmModeModeInfo* mode { nullptr };
+        Device::Output output;
         std::pair<uint16_t, uint16_t> size;
-        uint32_t crtcId { 0 };
-        uint32_t connectorId { 0 };
+        OutputTransform transform;
+        uint32_t modeBlob { 0 };
+        bool adaptiveSync { false };
+        bool bound { false };
+        bool connected { false };
+        bool modeSet { false };
     } m_drm;
 
     struct {
-        int fd { -1 };
-        struct gbm_device* device;
-    } m_gbm;
+        std::unordered_map<uint32_t, Framebuffer> fbMap;
+        std::pair<bool, uint32_t> nextFB;
+        std::pair<bool, uint32_t> lockedFB;
+        std::pair<bool, uint32_t> queuedFB;
+    } m_display;
+
+    // Set when frames are copied into dumb buffers rather than scanned out
+    // directly, in which case buffers go back to the renderer once copied.
+    std::unique_ptr<SoftwareScanout> m_software;
 
+    // The cursor lives on its own plane, so moving it never needs a new frame.
+    // The image is kept as set, to be rotated again when the output changes.
     struct {
-        GSource* source;
-        std::unordered_map<uint32_t, std::pair<struct gbm_bo*, uint32_t>> fbMap;
-        PageFlipHandlerData pageFlipData;
-    } m_display;
+        Device::DumbBuffer buffer;
+        struct {
+            std::vector<uint32_t> pixels;
+            uint32_t width { 0 };
+            uint32_t height { 0 };
+        } image;
+        std::pair<int32_t, int32_t> hotspot { 0, 0 };
+        std::pair<int32_t, int32_t> position { 0, 0 };
+        bool visible { false };
+    } m_cursor;
+
+    struct {
+        uint64_t queued { 0 };
+        uint64_t replaced { 0 };
+        uint64_t dropped { 0 };
+        // Largest number of imported framebuffers held at once.
+        size_t framebuffers { 0 };
+
+        // Intervals between consecutive flips, in microseconds.
+        uint64_t lastPresentation { 0 };
+        uint64_t intervals { 0 };
+        uint64_t intervalSum { 0 };
+        uint64_t intervalMin { UINT64_MAX };
+        uint64_t intervalMax { 0 };
+    } m_stats;
+
+    // Time to first frame, from the creation of the view.
+    struct {
+        int64_t time { 0 };
+        bool reusedMode { false };
+        bool firstFrame { false };
+    } m_startup;
 
     struct {
         IPC::Host ipcHost;
@@ -142,218 +167,682 @@ public:
     } m_renderer;
 };
 
-static void pageFlipHandler(int, unsigned, unsigned, unsigned, void* data)
+ViewBackend::ViewBackend(struct wpe_view_backend* backend)
+    : backend(backend)
+    , m_device(Device::singleton())
 {
-    auto& handlerData = *static_cast<PageFlipHandlerData*>(data);
-    if (!handlerData.backend)
+    m_startup.time = g_get_monotonic_time();
+    if (getenv("WPE_DRM_SOFTWARE"))
+        m_software.reset(new SoftwareScanout(m_device));
+
+    viewBackends().insert({ backend, this });
+    m_renderer.ipcHost.initialize(*this);
+
+    // Without a compositor, input is read from the devices directly.
+    if (!getenv("WPE_DRM_DISABLE_INPUT"))
+        Input::singleton().addClient(*this);
+
+    // Without an output yet, the view waits for one to be plugged in.
+    m_device.registerClient(*this);
+    if (!m_device.claimOutput(*this, OutputPolicy::current(), m_drm.output)) {
+        fprintf(stderr, "ViewBackend: no DRM output available\n");
         return;
+    }
 
-    {
-        IPC::Message message;
-        IPC::GBM::FrameComplete::construct(message);
-        handlerData.backend->m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    auto& output = m_drm.output;
+    m_drm.bound = true;
+    m_drm.connected = true;
+    configureTransform();
+    configureAdaptiveSync();
+    m_drm.size = logicalSize();
+    fprintf(stderr, "ViewBackend: using %s at %ux%u@%.2f\n", output.name.c_str(),
+        output.mode.hdisplay, output.mode.vdisplay, modeRefresh(output.mode) / 1000.0);
+
+    // When the output already shows the selected mode, whatever is on screen
+    // stays there until the first frame is flipped in, avoiding a blank
+    // modeset. Anything beyond a plain flip still needs the modeset.
+    if (m_drm.transform.isIdentity() && !m_drm.adaptiveSync
+        && isOutputActive(m_device.fd(), output.connectorId, output.crtcId, output.mode)) {
+        fprintf(stderr, "ViewBackend: %s already in the selected mode, skipping the modeset\n", output.name.c_str());
+        m_drm.modeSet = true;
+        m_startup.reusedMode = true;
     }
+}
 
-    auto bufferToRelease = handlerData.lockedFB;
-    handlerData.lockedFB = handlerData.nextFB;
-    handlerData.nextFB = { false, 0 };
+ViewBackend::~ViewBackend()
+{
+    if (getenv("WPE_MESA_STATS")) {
+        fprintf(stderr, "ViewBackend: commits queued %" PRIu64 ", replaced %" PRIu64 ", dropped %" PRIu64 ", at most %zu framebuffers\n",
+            m_stats.queued, m_stats.replaced, m_stats.dropped, m_stats.framebuffers);
+        if (m_stats.intervals) {
+            fprintf(stderr, "ViewBackend: presentation interval %.2f ms average, %.2f ms min, %.2f ms max over %" PRIu64 " frames, %.1f flips/s%s\n",
+                m_stats.intervalSum / 1000.0 / m_stats.intervals, m_stats.intervalMin / 1000.0, m_stats.intervalMax / 1000.0,
+                m_stats.intervals, m_stats.intervals * 1000000.0 / m_stats.intervalSum, m_drm.adaptiveSync ? " (VRR)" : "");
+        }
+        if (m_software && m_software->stats().frames) {
+            auto& stats = m_software->stats();
+            fprintf(stderr, "ViewBackend: software scanout copied %.1f KiB in %.2f ms per frame on average\n",
+                stats.bytesCopied / 1024.0 / stats.frames, stats.copyTime / 1000.0 / stats.frames);
+        }
+    }
+
+    viewBackends().erase(backend);
+    m_renderer.ipcHost.deinitialize();
+    if (!getenv("WPE_DRM_DISABLE_INPUT"))
+        Input::singleton().removeClient(*this);
 
-    if (bufferToRelease.first) {
-        IPC::Message message;
-        IPC::GBM::ReleaseBuffer::construct(message, bufferToRelease.second);
-        handlerData.backend->m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    if (m_cursor.buffer.handle) {
+        if (m_drm.bound && m_drm.connected)
+            drmModeSetCursor(m_device.fd(), m_drm.output.crtcId, 0, 0, 0);
+        m_device.destroyDumbBuffer(m_cursor.buffer);
     }
+
+    if (m_renderer.pendingBufferFd != -1)
+        close(m_renderer.pendingBufferFd);
+    m_renderer.pendingBufferFd = -1;
+
+    if (m_drm.modeBlob)
+        drmModeDestroyPropertyBlob(m_device.fd(), m_drm.modeBlob);
+
+    m_software = nullptr;
+    m_device.unregisterClient(*this);
+    m_drm = { };
+
+    // The device outlives this view, so framebuffers and imported buffers
+    // have to be returned explicitly.
+    for (auto& it : m_display.fbMap) {
+        drmModeRmFB(m_device.fd(), it.second.id);
+        gbm_bo_destroy(it.second.bo);
+    }
+    m_display = { };
 }
 
-ViewBackend::ViewBackend(struct wpe_view_backend* backend)
-    : backend(backend)
+void ViewBackend::handleFd(int fd)
+{
+    if (m_renderer.pendingBufferFd != -1)
+        close(m_renderer.pendingBufferFd);
+    m_renderer.pendingBufferFd = fd;
+}
+
+void ViewBackend::handleMessage(char* data, size_t size)
 {
-    decltype(m_drm) drm;
-    auto drmCleanup = defer(
-        [&drm] {
-            if (drm.mode)
-                drmModeFreeModeInfo(drm.mode);
-            if (drm.fd >= 0)
-                close(drm.fd);
-        });
-
-    // FIXME: This path should be retrieved via udev.
-    const char* renderCard = getenv("WPE_RENDER_CARD");
-    if (!renderCard)
-        renderCard = "/dev/dri/card0";
-    drm.fd = open(renderCard, O_RDWR | O_CLOEXEC);
-    if (drm.fd < 0) {
-        fprintf(stderr, "ViewBackend: couldn't connect DRM to card %s\n", renderCard);
+    if (size != IPC::Message::size)
+        return;
+
+    auto& message = IPC::Message::cast(data);
+    if (message.messageCode != IPC::GBM::BufferCommit::code)
+        return;
+
+    auto& bufferCommit = IPC::GBM::BufferCommit::cast(message);
+
+    if (m_renderer.pendingBufferFd >= 0) {
+        int fd = m_renderer.pendingBufferFd;
+        m_renderer.pendingBufferFd = -1;
+
+        // After a resize the renderer may hand over a new buffer under a handle
+        // that is already known.
+        auto it = m_display.fbMap.find(bufferCommit.handle);
+        if (it != m_display.fbMap.end()) {
+            drmModeRmFB(m_device.fd(), it->second.id);
+            gbm_bo_destroy(it->second.bo);
+            m_display.fbMap.erase(it);
+        }
+
+        struct gbm_bo* bo = nullptr;
+        if (!m_software) {
+            struct gbm_import_fd_data fdData = { fd, bufferCommit.width, bufferCommit.height, bufferCommit.stride, bufferCommit.format };
+            bo = gbm_bo_import(m_device.gbmDevice(), GBM_BO_IMPORT_FD, &fdData, GBM_BO_USE_SCANOUT);
+        }
+
+        uint32_t fbID = 0;
+        if (bo && drmModeAddFB(m_device.fd(), gbm_bo_get_width(bo), gbm_bo_get_height(bo),
+            24, 32, gbm_bo_get_stride(bo), gbm_bo_get_handle(bo).u32, &fbID)) {
+            fprintf(stderr, "ViewBackend: failed to add FB: %s, fbID %d\n", strerror(errno), fbID);
+            gbm_bo_destroy(bo);
+            bo = nullptr;
+        }
+
+        if (bo) {
+            close(fd);
+            m_display.fbMap.insert({ bufferCommit.handle, { bo, fbID, gbm_bo_get_width(bo), gbm_bo_get_height(bo) } });
+            m_stats.framebuffers = std::max(m_stats.framebuffers, m_display.fbMap.size());
+        } else {
+            // Buffers the display can't scan out, e.g. from a software renderer
+            // without a GPU, are copied instead.
+            if (!m_software) {
+                fprintf(stderr, "ViewBackend: buffer %u can't be scanned out directly, using software scanout\n", bufferCommit.handle);
+                m_software.reset(new SoftwareScanout(m_device));
+            }
+            if (!m_software->importBuffer(bufferCommit.handle, fd, bufferCommit.width, bufferCommit.height, bufferCommit.stride)) {
+                // Not dropFrame(), since a flip may still be in flight with a
+                // copy the software scanout has to keep. The fd is gone, so
+                // the renderer has to send it again.
+                dropBuffer(bufferCommit.handle);
+                releaseBuffer(bufferCommit.handle);
+                ++m_stats.dropped;
+
+                IPC::Message message;
+                IPC::GBM::FrameComplete::construct(message);
+                m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+                return;
+            }
+        }
+    }
+
+    if (!m_display.nextFB.first) {
+        schedulePageFlip(bufferCommit.handle);
         return;
     }
 
-    drm_magic_t magic;
-    if (drmGetMagic(drm.fd, &magic) || drmAuthMagic(drm.fd, magic))
+    // A flip is still in flight. Keep only the most recent commit, handing the
+    // superseded one straight back to the renderer.
+    if (m_display.queuedFB.first) {
+        releaseBuffer(m_display.queuedFB.second);
+        ++m_stats.replaced;
+    }
+    m_display.queuedFB = { true, bufferCommit.handle };
+    ++m_stats.queued;
+}
+
+void ViewBackend::pageFlipped(unsigned, unsigned sec, unsigned usec)
+{
+    // Flips completed synchronously by a modeset carry no timestamp.
+    if (sec || usec) {
+        uint64_t presentation = uint64_t(sec) * 1000000 + usec;
+        if (m_stats.lastPresentation && presentation > m_stats.lastPresentation) {
+            uint64_t interval = presentation - m_stats.lastPresentation;
+            ++m_stats.intervals;
+            m_stats.intervalSum += interval;
+            m_stats.intervalMin = std::min(m_stats.intervalMin, interval);
+            m_stats.intervalMax = std::max(m_stats.intervalMax, interval);
+        }
+        m_stats.lastPresentation = presentation;
+    } else
+        m_stats.lastPresentation = 0;
+
+    auto bufferToRelease = m_display.lockedFB;
+    m_display.lockedFB = m_display.nextFB;
+    m_display.nextFB = { false, 0 };
+    if (m_software)
+        m_software->presented();
+
+    if (m_display.lockedFB.first && !m_startup.firstFrame) {
+        m_startup.firstFrame = true;
+        fprintf(stderr, "ViewBackend: first frame on screen after %.1f ms%s\n",
+            (g_get_monotonic_time() - m_startup.time) / 1000.0, m_startup.reusedMode ? " (modeset skipped)" : "");
+    }
+
+    // Copied buffers were handed back as soon as the copy was done.
+    if (bufferToRelease.first && !(m_software && m_software->hasBuffer(bufferToRelease.second)))
+        releaseBuffer(bufferToRelease.second);
+
+    // A commit that arrived while the flip was in flight can be put on screen
+    // now. If it can't, dropping it already completed the frame.
+    if (m_display.queuedFB.first) {
+        uint32_t handle = m_display.queuedFB.second;
+        m_display.queuedFB = { false, 0 };
+        if (!schedulePageFlip(handle))
+            return;
+    }
+
+    IPC::Message message;
+    IPC::GBM::FrameComplete::construct(message);
+    m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+void ViewBackend::outputsChanged()
+{
+    if (!m_drm.bound) {
+        if (!m_device.claimOutput(*this, OutputPolicy::current(), m_drm.output))
+            return;
+        m_drm.bound = true;
+    }
+
+    auto& output = m_drm.output;
+    const ConnectorInfo* connector = m_device.connector(output.connectorId);
+    if (!connector || !connector->connected || connector->modes.empty()) {
+        if (m_drm.connected)
+            fprintf(stderr, "ViewBackend: %s disconnected\n", output.name.c_str());
+        m_drm.connected = false;
+        m_drm.modeSet = false;
         return;
+    }
+
+    configureTransform();
+    configureAdaptiveSync();
 
-    decltype(m_gbm) gbm;
-    auto gbmCleanup = defer(
-        [&gbm] {
-            if (gbm.device)
-                gbm_device_destroy(gbm.device);
-            if (gbm.fd >= 0)
-                close(gbm.fd);
-        });
-
-    gbm.device = gbm_create_device(drm.fd);
-    if (!gbm.device)
+    const drmModeModeInfo* mode = selectMode(*connector, OutputPolicy::current());
+    bool wasConnected = m_drm.connected;
+    m_drm.connected = true;
+    if (wasConnected && !std::memcmp(mode, &output.mode, sizeof(drmModeModeInfo)))
         return;
 
-    drmModeRes* resources = drmModeGetResources(drm.fd);
-    if (!resources)
+    output.mode = *mode;
+    m_drm.modeSet = false;
+    if (m_drm.modeBlob)
+        drmModeDestroyPropertyBlob(m_device.fd(), m_drm.modeBlob);
+    m_drm.modeBlob = 0;
+    fprintf(stderr, "ViewBackend: %s connected at %ux%u@%.2f\n", output.name.c_str(),
+        output.mode.hdisplay, output.mode.vdisplay, modeRefresh(output.mode) / 1000.0);
+
+    // A new size needs new buffers from the renderer, which the next commit
+    // will use to set the mode.
+    std::pair<uint16_t, uint16_t> size = logicalSize();
+    if (size != m_drm.size) {
+        m_drm.size = size;
+        wpe_view_backend_dispatch_set_size(backend, m_drm.size.first, m_drm.size.second);
         return;
-    auto drmResourcesCleanup = defer([&resources] { drmModeFreeResources(resources); });
+    }
 
-    drmModeConnector* connector = nullptr;
-    for (int i = 0; i < resources->count_connectors; ++i) {
-        connector = drmModeGetConnector(drm.fd, resources->connectors[i]);
-        if (connector->connection == DRM_MODE_CONNECTED)
-            break;
+    // Otherwise the frame already on screen can be shown again right away.
+    if (m_display.lockedFB.first && !m_display.nextFB.first) {
+        Framebuffer framebuffer;
+        SoftwareScanout::Target target;
+        auto it = m_display.fbMap.find(m_display.lockedFB.second);
+        if (m_software && m_software->currentTarget(target))
+            framebuffer = { nullptr, target.fbId, target.width, target.height };
+        else if (it != m_display.fbMap.end())
+            framebuffer = it->second;
+        else
+            return;
 
-        drmModeFreeConnector(connector);
+        int ret = output.planeId ? commitAtomic(framebuffer, DRM_MODE_ATOMIC_ALLOW_MODESET)
+            : drmModeSetCrtc(m_device.fd(), output.crtcId, framebuffer.id, 0, 0, &output.connectorId, 1, &output.mode);
+        if (!ret) {
+            m_drm.modeSet = true;
+            updateCursor();
+        }
     }
+}
 
-    if (!connector)
-        return;
-    auto drmConnectorCleanup = defer([&connector] { drmModeFreeConnector(connector); });
-
-    int area = 0;
-    for (int i = 0; i < connector->count_modes; ++i) {
-        drmModeModeInfo* currentMode = &connector->modes[i];
-        int modeArea = currentMode->hdisplay * currentMode->vdisplay;
-        if (modeArea > area) {
-            drm.mode = currentMode;
-            drm.size = { currentMode->hdisplay, currentMode->vdisplay };
-            area = modeArea;
+// Returns false when the frame was dropped, which already sent FrameComplete.
+bool ViewBackend::schedulePageFlip(uint32_t handle)
+{
+    if (!m_drm.connected) {
+        dropFrame(handle);
+        return false;
+    }
+
+    Framebuffer framebuffer;
+    // Only known for frames copied on the CPU; the renderer doesn't tell
+    // which parts of its buffers changed.
+    struct drm_mode_rect damage;
+    bool hasDamage = false;
+    if (m_software && m_software->hasBuffer(handle)) {
+        SoftwareScanout::Target target;
+        if (!m_software->update(handle, target)) {
+            dropFrame(handle);
+            return false;
+        }
+        framebuffer = { nullptr, target.fbId, target.width, target.height };
+        if (target.damage.width && target.damage.height) {
+            damage = { int32_t(target.damage.x), int32_t(target.damage.y),
+                int32_t(target.damage.x + target.damage.width), int32_t(target.damage.y + target.damage.height) };
+            hasDamage = true;
+        }
+    } else {
+        // A commit without an fd of a buffer that isn't imported, e.g. one
+        // whose import failed before the renderer got told.
+        auto it = m_display.fbMap.find(handle);
+        if (it == m_display.fbMap.end()) {
+            dropBuffer(handle);
+            dropFrame(handle);
+            return false;
         }
+        framebuffer = it->second;
     }
 
-    if (!drm.mode)
-        return;
+    auto& output = m_drm.output;
 
-    drmModeEncoder* encoder = nullptr;
-    for (int i = 0; i < resources->count_encoders; ++i) {
-        encoder = drmModeGetEncoder(drm.fd, resources->encoders[i]);
-        if (encoder->encoder_id == connector->encoder_id)
-            break;
+    if (output.planeId && !m_drm.modeSet) {
+        // Not every plane can rotate or scale every buffer. When the driver
+        // rejects the configuration, fall back to presenting at the mode size.
+        if (m_drm.adaptiveSync && commitAtomic(framebuffer, DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_TEST_ONLY)) {
+            fprintf(stderr, "ViewBackend: variable refresh rate rejected on %s, using a fixed refresh\n", output.name.c_str());
+            m_drm.adaptiveSync = false;
+        }
 
-        drmModeFreeEncoder(encoder);
+        if (commitAtomic(framebuffer, DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_TEST_ONLY)) {
+            if (m_drm.transform.isIdentity()) {
+                fprintf(stderr, "ViewBackend: atomic modeset rejected, using legacy modesetting\n");
+                output.planeId = 0;
+            } else {
+                fprintf(stderr, "ViewBackend: rotation or scaling not supported on %s, disabling it\n", output.name.c_str());
+                m_drm.transform = OutputTransform();
+                m_drm.size = logicalSize();
+                dropFrame(handle);
+                wpe_view_backend_dispatch_set_size(backend, m_drm.size.first, m_drm.size.second);
+                return false;
+            }
+        }
     }
 
-    if (!encoder)
-        return;
-    auto drmEncoderCleanup = defer([&encoder] { drmModeFreeEncoder(encoder); });
-
-    drm.crtcId = encoder->crtc_id;
-    drm.connectorId = connector->connector_id;
-
-    m_drm = drm;
-    drmCleanup.valid = false;
-    m_gbm = gbm;
-    gbmCleanup.valid = false;
-    fprintf(stderr, "ViewBackend: successfully initialized DRM.\n");
-
-    m_display.source = g_source_new(&DRM::EventSource::sourceFuncs, sizeof(DRM::EventSource));
-    auto* displaySource = reinterpret_cast<DRM::EventSource*>(m_display.source);
-    displaySource->drmFD = m_drm.fd;
-    displaySource->eventContext = {
-        DRM_EVENT_CONTEXT_VERSION,
-        nullptr,
-        &pageFlipHandler
-    };
+    // The selected mode is only programmed once the first frame is available,
+    // after which that frame counts as flipped right away.
+    if (!m_drm.modeSet) {
+        int ret = output.planeId ? commitAtomic(framebuffer, DRM_MODE_ATOMIC_ALLOW_MODESET)
+            : drmModeSetCrtc(m_device.fd(), output.crtcId, framebuffer.id, 0, 0, &output.connectorId, 1, &output.mode);
+        if (!ret) {
+            m_drm.modeSet = true;
+            updateCursor();
+            m_display.nextFB = { true, handle };
+            if (m_software && m_software->hasBuffer(handle))
+                releaseBuffer(handle);
+            pageFlipped(0, 0, 0);
+            return true;
+        }
 
-    displaySource->pfd.fd = m_drm.fd;
-    displaySource->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
-    displaySource->pfd.revents = 0;
-    g_source_add_poll(m_display.source, &displaySource->pfd);
+        fprintf(stderr, "ViewBackend: failed to set mode: %s\n", strerror(errno));
+    }
 
-    g_source_set_name(m_display.source, "[WPE] DRM");
-    g_source_set_priority(m_display.source, G_PRIORITY_HIGH + 30);
-    g_source_set_can_recurse(m_display.source, TRUE);
-    g_source_attach(m_display.source, g_main_context_get_thread_default());
+    int ret = output.planeId ? commitAtomic(framebuffer, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, hasDamage ? &damage : nullptr)
+        : m_device.pageFlip(output.crtcId, framebuffer.id);
+    if (ret && m_startup.reusedMode && !m_startup.firstFrame) {
+        // The state left by the bootloader can't always be flipped from.
+        fprintf(stderr, "ViewBackend: failed to flip into the existing mode, doing a full modeset\n");
+        m_startup.reusedMode = false;
+        m_drm.modeSet = false;
+        if (m_software)
+            m_software->discard();
+        return schedulePageFlip(handle);
+    }
 
-    m_display.pageFlipData.backend = this;
+    if (ret) {
+        fprintf(stderr, "ViewBackend: failed to queue page flip: %s\n", strerror(errno));
+        dropFrame(handle);
+        return false;
+    }
 
-    m_renderer.ipcHost.initialize(*this);
+    m_display.nextFB = { true, handle };
+    if (m_software && m_software->hasBuffer(handle))
+        releaseBuffer(handle);
+    return true;
 }
 
-ViewBackend::~ViewBackend()
+int ViewBackend::commitAtomic(const Framebuffer& framebuffer, uint32_t flags, const struct drm_mode_rect* damage)
 {
-    m_renderer.ipcHost.deinitialize();
+    auto& output = m_drm.output;
+    int fd = m_device.fd();
+
+    if (!m_drm.modeBlob && drmModeCreatePropertyBlob(fd, &output.mode, sizeof(drmModeModeInfo), &m_drm.modeBlob))
+        return -1;
 
-    m_display.fbMap = { };
-    if (m_display.source) {
-        g_source_destroy(m_display.source);
-        g_source_unref(m_display.source);
+    drmModeAtomicReq* request = drmModeAtomicAlloc();
+    if (!request)
+        return -1;
+
+    bool valid = true;
+    if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+        valid &= m_device.addProperty(request, output.connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", output.crtcId);
+        valid &= m_device.addProperty(request, output.crtcId, DRM_MODE_OBJECT_CRTC, "MODE_ID", m_drm.modeBlob);
+        valid &= m_device.addProperty(request, output.crtcId, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+
+        // Drivers without VRR have no such property, which is fine when disabling it.
+        if (!m_device.addProperty(request, output.crtcId, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", m_drm.adaptiveSync))
+            valid &= !m_drm.adaptiveSync;
     }
-    m_display.source = nullptr;
-    m_display.pageFlipData = { nullptr, { }, { } };
 
-    if (m_gbm.device)
-        gbm_device_destroy(m_gbm.device);
-    m_gbm = { };
+    // The whole buffer is scanned out, stretched over the whole mode. Source
+    // coordinates are 16.16 fixed point, in the unrotated buffer.
+    uint32_t planeId = output.planeId;
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "FB_ID", framebuffer.id);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID", output.crtcId);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "SRC_X", 0);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "SRC_W", uint64_t(framebuffer.width) << 16);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "SRC_H", uint64_t(framebuffer.height) << 16);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W", output.mode.hdisplay);
+    valid &= m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H", output.mode.vdisplay);
+
+    // Planes without a rotation property can only scan out unrotated.
+    uint64_t rotation = DRM_MODE_ROTATE_0;
+    switch (m_drm.transform.rotation) {
+    case 90:
+        rotation = DRM_MODE_ROTATE_90;
+        break;
+    case 180:
+        rotation = DRM_MODE_ROTATE_180;
+        break;
+    case 270:
+        rotation = DRM_MODE_ROTATE_270;
+        break;
+    }
+    if (!m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "rotation", rotation))
+        valid &= rotation == DRM_MODE_ROTATE_0;
+
+    // Damage is only a hint, in framebuffer coordinates; without it, or
+    // without driver support, the whole plane is refetched.
+    uint32_t damageBlob = 0;
+    if (damage && !drmModeCreatePropertyBlob(fd, damage, sizeof(struct drm_mode_rect), &damageBlob)
+        && !m_device.addProperty(request, planeId, DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS", damageBlob)) {
+        drmModeDestroyPropertyBlob(fd, damageBlob);
+        damageBlob = 0;
+    }
 
-    if (m_drm.mode)
-        drmModeFreeModeInfo(m_drm.mode);
-    if (m_drm.fd >= 0)
-        close(m_drm.fd);
-    m_drm = { };
+    int ret = valid ? m_device.atomicCommit(request, flags, output.crtcId) : -1;
+    drmModeAtomicFree(request);
+    // The committed state holds its own reference to the blob.
+    if (damageBlob)
+        drmModeDestroyPropertyBlob(fd, damageBlob);
+    return ret;
 }
 
-void ViewBackend::handleFd(int fd)
+void ViewBackend::configureTransform()
 {
-    if (m_renderer.pendingBufferFd != -1)
-        close(m_renderer.pendingBufferFd);
-    m_renderer.pendingBufferFd = fd;
+    m_drm.transform = OutputPolicy::current().transformFor(m_drm.output.name);
+    if (!m_drm.transform.isIdentity() && !m_drm.output.planeId) {
+        fprintf(stderr, "ViewBackend: rotating or scaling %s needs atomic modesetting, ignoring it\n", m_drm.output.name.c_str());
+        m_drm.transform = OutputTransform();
+    }
 }
 
-void ViewBackend::handleMessage(char* data, size_t size)
+void ViewBackend::configureAdaptiveSync()
 {
-    if (size != IPC::Message::size)
-        return;
+    const ConnectorInfo* connector = m_device.connector(m_drm.output.connectorId);
+    bool adaptiveSync = OutputPolicy::current().adaptiveSync && m_drm.output.planeId
+        && connector && connector->vrrCapable;
+    if (adaptiveSync != m_drm.adaptiveSync) {
+        fprintf(stderr, "ViewBackend: variable refresh rate %s on %s\n", adaptiveSync ? "enabled" : "disabled", m_drm.output.name.c_str());
+        m_drm.adaptiveSync = adaptiveSync;
+        m_drm.modeSet = false;
+    }
+}
 
-    auto& message = IPC::Message::cast(data);
-    if (message.messageCode != IPC::GBM::BufferCommit::code)
-        return;
+std::pair<uint16_t, uint16_t> ViewBackend::logicalSize() const
+{
+    auto size = m_drm.transform.logicalSize(m_drm.output.mode);
+    return { size.first, size.second };
+}
 
-    auto& bufferCommit = IPC::GBM::BufferCommit::cast(message);
-    uint32_t fbID = 0;
+void ViewBackend::releaseBuffer(uint32_t handle)
+{
+    IPC::Message message;
+    IPC::GBM::ReleaseBuffer::construct(message, handle);
+    m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
 
-    if (m_renderer.pendingBufferFd >= 0) {
-        int fd = m_renderer.pendingBufferFd;
-        m_renderer.pendingBufferFd = -1;
+// The renderer sends the fd again with the next commit of the buffer.
+void ViewBackend::dropBuffer(uint32_t handle)
+{
+    IPC::Message message;
+    IPC::GBM::BufferDropped::construct(message, handle);
+    m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
 
-        assert(m_display.fbMap.find(bufferCommit.handle) == m_display.fbMap.end());
+void ViewBackend::dropFrame(uint32_t handle)
+{
+    // The frame is dropped, but the renderer must not be left waiting on it.
+    if (m_software)
+        m_software->discard();
+    releaseBuffer(handle);
+    ++m_stats.dropped;
+
+    IPC::Message message;
+    IPC::GBM::FrameComplete::construct(message);
+    m_renderer.ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
 
-        struct gbm_import_fd_data fdData = { fd, bufferCommit.width, bufferCommit.height, bufferCommit.stride, bufferCommit.format };
-        struct gbm_bo* bo = gbm_bo_import(m_gbm.device, GBM_BO_IMPORT_FD, &fdData, GBM_BO_USE_SCANOUT);
-        uint32_t primeHandle = gbm_bo_get_handle(bo).u32;
+void ViewBackend::setCursorImage(const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t stride, int32_t hotspotX, int32_t hotspotY)
+{
+    if (!pixels) {
+        m_cursor.visible = false;
+        updateCursor();
+        return;
+    }
 
-        int ret = drmModeAddFB(m_drm.fd, gbm_bo_get_width(bo), gbm_bo_get_height(bo),
-            24, 32, gbm_bo_get_stride(bo), primeHandle, &fbID);
-        if (ret) {
-            fprintf(stderr, "ViewBackend: failed to add FB: %s, fbID %d\n", strerror(errno), fbID);
+    if (!m_cursor.buffer.handle) {
+        auto size = m_device.cursorSize();
+        if (!m_device.createDumbBuffer(size.first, size.second, m_cursor.buffer))
             return;
+    }
+
+    auto& image = m_cursor.image;
+    image.pixels.resize(width * height);
+    image.width = width;
+    image.height = height;
+    auto* source = reinterpret_cast<const uint8_t*>(pixels);
+    for (uint32_t y = 0; y < height; ++y)
+        std::memcpy(&image.pixels[y * width], source + y * stride, width * 4);
+
+    m_cursor.hotspot = { hotspotX, hotspotY };
+    m_cursor.visible = true;
+    updateCursor();
+}
+
+// The image is rotated like the primary plane, so that it shows upright, but
+// it isn't scaled with the render size: it keeps its size in output pixels.
+void ViewBackend::writeCursorImage()
+{
+    auto& buffer = m_cursor.buffer;
+    auto& image = m_cursor.image;
+    uint32_t rotation = m_drm.transform.rotation;
+    bool swapped = rotation == 90 || rotation == 270;
+    uint32_t width = swapped ? image.height : image.width;
+    uint32_t height = swapped ? image.width : image.height;
+    if (width > buffer.width || height > buffer.height)
+        fprintf(stderr, "ViewBackend: cursor image of %ux%u clipped to %ux%u\n", width, height, buffer.width, buffer.height);
+
+    auto* target = static_cast<uint8_t*>(buffer.data);
+    for (uint32_t y = 0; y < buffer.height; ++y) {
+        auto* row = reinterpret_cast<uint32_t*>(target + y * buffer.pitch);
+        for (uint32_t x = 0; x < buffer.width; ++x) {
+            if (x >= width || y >= height) {
+                row[x] = 0;
+                continue;
+            }
+
+            // The pixel of the image that lands here once rotated.
+            uint32_t sourceX = x, sourceY = y;
+            switch (rotation) {
+            case 90:
+                sourceX = image.width - 1 - y;
+                sourceY = x;
+                break;
+            case 180:
+                sourceX = image.width - 1 - x;
+                sourceY = image.height - 1 - y;
+                break;
+            case 270:
+                sourceX = y;
+                sourceY = image.height - 1 - x;
+                break;
+            }
+            row[x] = image.pixels[sourceY * image.width + sourceX];
         }
+    }
+}
 
-        m_display.fbMap.insert({ bufferCommit.handle, { bo, fbID } });
-        m_display.pageFlipData.nextFB = { true, bufferCommit.handle };
-    } else {
-        auto it = m_display.fbMap.find(bufferCommit.handle);
-        assert(it != m_display.fbMap.end());
+std::pair<int32_t, int32_t> ViewBackend::cursorHotspot() const
+{
+    auto& image = m_cursor.image;
+    auto& hotspot = m_cursor.hotspot;
+    switch (m_drm.transform.rotation) {
+    case 90:
+        return { hotspot.second, int32_t(image.width) - 1 - hotspot.first };
+    case 180:
+        return { int32_t(image.width) - 1 - hotspot.first, int32_t(image.height) - 1 - hotspot.second };
+    case 270:
+        return { int32_t(image.height) - 1 - hotspot.second, hotspot.first };
+    }
+    return hotspot;
+}
+
+void ViewBackend::moveCursor(int32_t x, int32_t y)
+{
+    m_cursor.position = { x, y };
+    if (!m_cursor.visible || !m_drm.modeSet)
+        return;
+
+    auto position = outputPosition(x, y);
+    auto hotspot = cursorHotspot();
+    drmModeMoveCursor(m_device.fd(), m_drm.output.crtcId,
+        position.first - hotspot.first, position.second - hotspot.second);
+}
+
+void ViewBackend::updateCursor()
+{
+    if (!m_drm.modeSet)
+        return;
+
+    int fd = m_device.fd();
+    uint32_t crtcId = m_drm.output.crtcId;
+    if (!m_cursor.visible) {
+        drmModeSetCursor(fd, crtcId, 0, 0, 0);
+        return;
+    }
+
+    // The rotation may have changed with the mode.
+    writeCursorImage();
+
+    auto& buffer = m_cursor.buffer;
+    auto hotspot = cursorHotspot();
+    if (drmModeSetCursor2(fd, crtcId, buffer.handle, buffer.width, buffer.height, hotspot.first, hotspot.second)
+        && drmModeSetCursor(fd, crtcId, buffer.handle, buffer.width, buffer.height)) {
+        fprintf(stderr, "ViewBackend: failed to set the cursor: %s\n", strerror(errno));
+        return;
+    }
 
-        fbID = it->second.second;
-        m_display.pageFlipData.nextFB = { true, bufferCommit.handle };
+    auto position = outputPosition(m_cursor.position.first, m_cursor.position.second);
+    drmModeMoveCursor(fd, crtcId, position.first - hotspot.first, position.second - hotspot.second);
+}
+
+// Cursor positions are in view coordinates, like input events, while the
+// cursor plane is placed in CRTC coordinates. The view is stretched over the
+// rotated mode and then rotated counter-clockwise, as in commitAtomic().
+std::pair<int32_t, int32_t> ViewBackend::outputPosition(int32_t x, int32_t y) const
+{
+    auto& mode = m_drm.output.mode;
+    uint32_t rotation = m_drm.transform.rotation;
+    bool swapped = rotation == 90 || rotation == 270;
+    int64_t width = swapped ? mode.vdisplay : mode.hdisplay;
+    int64_t height = swapped ? mode.hdisplay : mode.vdisplay;
+
+    int64_t scaledX = x;
+    int64_t scaledY = y;
+    if (m_drm.size.first && m_drm.size.second) {
+        scaledX = scaledX * width / m_drm.size.first;
+        scaledY = scaledY * height / m_drm.size.second;
     }
 
-    int ret = drmModePageFlip(m_drm.fd, m_drm.crtcId, fbID, DRM_MODE_PAGE_FLIP_EVENT, &m_display.pageFlipData);
-    if (ret)
-        fprintf(stderr, "ViewBackend: failed to queue page flip\n");
+    switch (rotation) {
+    case 90:
+        return { int32_t(scaledY), int32_t(width - scaledX) };
+    case 180:
+        return { int32_t(width - scaledX), int32_t(height - scaledY) };
+    case 270:
+        return { int32_t(height - scaledY), int32_t(scaledX) };
+    }
+    return { int32_t(scaledX), int32_t(scaledY) };
+}
+
+ViewBackend* ViewBackend::fromBackend(struct wpe_view_backend* backend)
+{
+    auto it = viewBackends().find(backend);
+    if (it == viewBackends().end())
+        return nullptr;
+    return it->second;
 }
 
 } // namespace DRM
@@ -387,4 +876,20 @@ struct wpe_view_backend_interface drm_view_backend_interface = {
     },
 };
 
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_drm_set_cursor_image(struct wpe_view_backend* backend, const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t stride, int32_t hotspot_x, int32_t hotspot_y)
+{
+    if (auto* viewBackend = DRM::ViewBackend::fromBackend(backend))
+        viewBackend->setCursorImage(pixels, width, height, stride, hotspot_x, hotspot_y);
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_drm_move_cursor(struct wpe_view_backend* backend, int32_t x, int32_t y)
+{
+    if (auto* viewBackend = DRM::ViewBackend::fromBackend(backend))
+        viewBackend->moveCursor(x, y);
+}
+
 }
@@ -61,6 +61,105 @@ struct BufferCommit {
 };
 static_assert(sizeof(BufferCommit) == Message::dataSize, "BufferCommit is of correct size");
 
+// Sent once per plane right after a new buffer fd, ahead of its BufferCommit,
+// so hosts that can import dma-bufs with explicit layouts know the modifier.
+struct BufferPlane {
+    uint32_t handle;
+    uint32_t plane;
+    uint32_t offset;
+    uint32_t stride;
+    uint32_t modifierHi;
+    uint32_t modifierLo;
+
+    static const uint64_t code = 51;
+    static void construct(Message& message, uint32_t handle, uint32_t plane, uint32_t offset, uint32_t stride, uint64_t modifier)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<BufferPlane*>(std::addressof(message.messageData));
+        messageData.handle = handle;
+        messageData.plane = plane;
+        messageData.offset = offset;
+        messageData.stride = stride;
+        messageData.modifierHi = modifier >> 32;
+        messageData.modifierLo = modifier & 0xffffffff;
+    }
+    static BufferPlane& cast(Message& message)
+    {
+        return *reinterpret_cast<BufferPlane*>(message.messageData);
+    }
+};
+static_assert(sizeof(BufferPlane) == Message::dataSize, "BufferPlane is of correct size");
+
+// Allocation hint from the host's compositor, one message per preferred
+// modifier of the given format. A count of zero clears any previous hint.
+struct SurfaceFeedback {
+    uint32_t format;
+    uint32_t flags;
+    uint32_t index;
+    uint32_t count;
+    uint32_t modifierHi;
+    uint32_t modifierLo;
+
+    enum Flags : uint32_t {
+        Scanout = 1 << 0,
+    };
+
+    static const uint64_t code = 52;
+    static void construct(Message& message, uint32_t format, uint32_t flags, uint32_t index, uint32_t count, uint64_t modifier)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<SurfaceFeedback*>(std::addressof(message.messageData));
+        messageData.format = format;
+        messageData.flags = flags;
+        messageData.index = index;
+        messageData.count = count;
+        messageData.modifierHi = modifier >> 32;
+        messageData.modifierLo = modifier & 0xffffffff;
+    }
+    static SurfaceFeedback& cast(Message& message)
+    {
+        return *reinterpret_cast<SurfaceFeedback*>(message.messageData);
+    }
+};
+static_assert(sizeof(SurfaceFeedback) == Message::dataSize, "SurfaceFeedback is of correct size");
+
+// When the buffer committed with the given handle reached the screen, in
+// CLOCK_MONOTONIC microseconds, with the output's refresh period when known.
+struct FramePresented {
+    uint32_t handle;
+    uint32_t flags;
+    uint32_t refresh;
+    uint32_t timeHi;
+    uint32_t timeLo;
+    uint8_t padding[4];
+
+    enum Flags : uint32_t {
+        VSync = 1 << 0,
+        HardwareClock = 1 << 1,
+        ZeroCopy = 1 << 2,
+    };
+
+    static const uint64_t code = 53;
+    static void construct(Message& message, uint32_t handle, uint32_t flags, uint32_t refresh, uint64_t time)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<FramePresented*>(std::addressof(message.messageData));
+        messageData.handle = handle;
+        messageData.flags = flags;
+        messageData.refresh = refresh;
+        messageData.timeHi = time >> 32;
+        messageData.timeLo = time & 0xffffffff;
+    }
+    static FramePresented& cast(Message& message)
+    {
+        return *reinterpret_cast<FramePresented*>(message.messageData);
+    }
+};
+static_assert(sizeof(FramePresented) == Message::dataSize, "FramePresented is of correct size");
+
 struct FrameComplete {
     uint8_t padding[24];
 
@@ -91,6 +190,51 @@ struct ReleaseBuffer {
 };
 static_assert(sizeof(ReleaseBuffer) == Message::dataSize, "ReleaseBuffer is of correct size");
 
+// The host destroyed its import of an idle buffer, so its fd has to be sent
+// again before the buffer is committed next.
+struct BufferDropped {
+    uint32_t handle;
+    uint8_t padding[20];
+
+    static const uint64_t code = 54;
+    static void construct(Message& message, uint32_t handle)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<BufferDropped*>(std::addressof(message.messageData));
+        messageData.handle = handle;
+    }
+    static BufferDropped& cast(Message& message)
+    {
+        return *reinterpret_cast<BufferDropped*>(message.messageData);
+    }
+};
+static_assert(sizeof(BufferDropped) == Message::dataSize, "BufferDropped is of correct size");
+
+// How long the renderer spent on the frame it commits next, from
+// frame_will_render to frame_rendered, in microseconds. Sent ahead of the
+// BufferCommit; hosts that don't adapt to it ignore it.
+struct FrameTime {
+    uint32_t handle;
+    uint32_t duration;
+    uint8_t padding[16];
+
+    static const uint64_t code = 55;
+    static void construct(Message& message, uint32_t handle, uint32_t duration)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<FrameTime*>(std::addressof(message.messageData));
+        messageData.handle = handle;
+        messageData.duration = duration;
+    }
+    static FrameTime& cast(Message& message)
+    {
+        return *reinterpret_cast<FrameTime*>(message.messageData);
+    }
+};
+static_assert(sizeof(FrameTime) == Message::dataSize, "FrameTime is of correct size");
+
 } // namespace GBM
 
 } // namespace IPC
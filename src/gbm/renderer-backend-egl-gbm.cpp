@@ -28,11 +28,16 @@
 
 #include "ipc.h"
 #include "ipc-gbm.h"
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstdio>
+#include <cstdlib>
 #include <fcntl.h>
 #include <gbm.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace GBM {
 
@@ -43,6 +48,16 @@ struct Backend {
         if (!renderNode)
             renderNode = "/dev/dri/renderD128";
         fd = open(renderNode, O_RDWR | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+
+        // Without a GPU there is no render node, but Mesa can still render with
+        // llvmpipe into dumb buffers allocated on a display-only card like vkms.
+        if (fd < 0 && !getenv("WPE_RENDER_NODE")) {
+            renderNode = getenv("WPE_RENDER_CARD");
+            if (!renderNode)
+                renderNode = "/dev/dri/card0";
+            fd = open(renderNode, O_RDWR | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+        }
+
         if (fd < 0) {
             fprintf(stderr, "FATAL: Unable to open the render node device %s\n", renderNode);
             return;
@@ -78,6 +93,11 @@ struct EGLTarget : public IPC::Client::Handler {
 
     ~EGLTarget()
     {
+        if (getenv("WPE_MESA_STATS") && stats.frames) {
+            fprintf(stderr, "renderer-gbm: render to presentation latency %.2f ms average, %.2f ms max over %" PRIu64 " frames, refresh %.2f ms\n",
+                stats.latencySum / 1000.0 / stats.frames, stats.latencyMax / 1000.0, stats.frames, stats.refresh / 1000000.0);
+        }
+
         ipcClient.deinitialize();
 
         if (surface)
@@ -111,6 +131,44 @@ struct EGLTarget : public IPC::Client::Handler {
             lockedBuffers.erase(it);
             break;
         }
+        case IPC::GBM::BufferDropped::code:
+        {
+            droppedBuffers.insert(IPC::GBM::BufferDropped::cast(message).handle);
+            break;
+        }
+        case IPC::GBM::FramePresented::code:
+        {
+            auto& framePresented = IPC::GBM::FramePresented::cast(message);
+            auto it = renderTimes.find(framePresented.handle);
+            if (it == renderTimes.end())
+                break;
+
+            int64_t time = (uint64_t(framePresented.timeHi) << 32) | framePresented.timeLo;
+            if (time > it->second) {
+                uint64_t latency = time - it->second;
+                ++stats.frames;
+                stats.latencySum += latency;
+                stats.latencyMax = std::max(stats.latencyMax, latency);
+            }
+            stats.refresh = framePresented.refresh;
+            renderTimes.erase(it);
+            break;
+        }
+        case IPC::GBM::SurfaceFeedback::code:
+        {
+            auto& surfaceFeedback = IPC::GBM::SurfaceFeedback::cast(message);
+            if (!surfaceFeedback.index)
+                feedback.pending.clear();
+            if (surfaceFeedback.index < surfaceFeedback.count)
+                feedback.pending.push_back((uint64_t(surfaceFeedback.modifierHi) << 32) | surfaceFeedback.modifierLo);
+            if (surfaceFeedback.index + 1 >= surfaceFeedback.count) {
+                feedback.format = surfaceFeedback.format;
+                feedback.flags = surfaceFeedback.flags;
+                feedback.modifiers.swap(feedback.pending);
+                feedback.pending.clear();
+            }
+            break;
+        }
         default:
             fprintf(stderr, "renderer-gbm: invalid message\n");
             break;
@@ -124,6 +182,30 @@ struct EGLTarget : public IPC::Client::Handler {
     uint32_t width { 0 };
     uint32_t height { 0 };
     std::unordered_map<uint32_t, struct gbm_bo*> lockedBuffers;
+    // Buffers the host has to import again.
+    std::unordered_set<uint32_t> droppedBuffers;
+
+    // When each locked buffer finished rendering, matched with the time the
+    // host reports it reached the screen.
+    std::unordered_map<uint32_t, int64_t> renderTimes;
+    // When the frame being rendered was started, 0 if none is.
+    int64_t frameStart { 0 };
+    struct {
+        uint64_t frames { 0 };
+        uint64_t latencySum { 0 };
+        uint64_t latencyMax { 0 };
+        uint32_t refresh { 0 };
+    } stats;
+
+    // Modifiers the compositor prefers for the surface, in preference order.
+    // The gbm_surface backs the EGL window for its whole lifetime, so updates
+    // only take effect for surfaces created after they arrive.
+    struct {
+        uint32_t format { 0 };
+        uint32_t flags { 0 };
+        std::vector<uint64_t> modifiers;
+        std::vector<uint64_t> pending;
+    } feedback;
 };
 
 struct EGLOffscreenTarget {
@@ -186,7 +268,20 @@ struct wpe_renderer_backend_egl_target_interface gbm_renderer_backend_egl_target
         auto* target = static_cast<GBM::EGLTarget*>(data);
         auto* backend = static_cast<GBM::Backend*>(backend_data);
 
-        target->surface = gbm_surface_create(backend->device, width, height, GBM_FORMAT_ARGB8888, 0);
+        // The host queues the compositor's allocation feedback as soon as the
+        // view is created, ahead of anything the main loop would dispatch.
+        target->ipcClient.dispatchPendingMessages();
+
+        target->surface = nullptr;
+#if defined(WPE_MESA_GBM_MODIFIERS) && WPE_MESA_GBM_MODIFIERS
+        auto& feedback = target->feedback;
+        if (feedback.format == GBM_FORMAT_ARGB8888 && !feedback.modifiers.empty()) {
+            target->surface = gbm_surface_create_with_modifiers(backend->device, width, height, GBM_FORMAT_ARGB8888,
+                feedback.modifiers.data(), feedback.modifiers.size());
+        }
+#endif
+        if (!target->surface)
+            target->surface = gbm_surface_create(backend->device, width, height, GBM_FORMAT_ARGB8888, 0);
         target->width = width;
         target->height = height;
     },
@@ -206,6 +301,8 @@ struct wpe_renderer_backend_egl_target_interface gbm_renderer_backend_egl_target
     // frame_will_render
     [](void* data)
     {
+        auto* target = static_cast<GBM::EGLTarget*>(data);
+        target->frameStart = g_get_monotonic_time();
     },
     // frame_rendered
     [](void* data)
@@ -221,20 +318,38 @@ struct wpe_renderer_backend_egl_target_interface gbm_renderer_backend_egl_target
 #endif
             target->lockedBuffers.insert({ handle, bo });
         assert(result.second);
+        int64_t now = g_get_monotonic_time();
+        target->renderTimes[handle] = now;
 
         auto* boData = static_cast<IPC::GBM::BufferCommit*>(gbm_bo_get_user_data(bo));
-        if (boData && (boData->width != target->width || boData->height != target->height)) {
+        bool dropped = target->droppedBuffers.erase(handle);
+        if (boData && (dropped || boData->width != target->width || boData->height != target->height)) {
             delete boData;
             boData = nullptr;
         }
         if (!boData) {
             target->ipcClient.sendFd(gbm_bo_get_fd(bo));
 
+#if defined(WPE_MESA_GBM_MODIFIERS) && WPE_MESA_GBM_MODIFIERS
+            uint64_t modifier = gbm_bo_get_modifier(bo);
+            for (int plane = 0; plane < gbm_bo_get_plane_count(bo); ++plane) {
+                IPC::Message message;
+                IPC::GBM::BufferPlane::construct(message, handle, plane, gbm_bo_get_offset(bo, plane), gbm_bo_get_stride_for_plane(bo, plane), modifier);
+                target->ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            }
+#endif
+
             boData = new IPC::GBM::BufferCommit{ handle, target->width, target->height, gbm_bo_get_stride(bo), gbm_bo_get_format(bo), 0 };
             gbm_bo_set_user_data(bo, boData, &GBM::destroyBOData);
         }
 
         IPC::Message message;
+        if (target->frameStart) {
+            IPC::GBM::FrameTime::construct(message, handle, std::min<int64_t>(now - target->frameStart, UINT32_MAX));
+            target->ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            target->frameStart = 0;
+        }
+
         IPC::GBM::BufferCommit::construct(message, boData->handle, boData->width, boData->height, boData->stride, boData->format);
         target->ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
     },
@@ -25,6 +25,7 @@
 
 #include "nested-compositor.h"
 
+#include "drm-output.h"
 #include "nc-renderer-host.h"
 #include "nc-view-display.h"
 #include <cassert>
@@ -175,6 +176,12 @@ public:
         struct gbm_bo* next_bo {nullptr};
     } m_display;
 
+    struct {
+        int64_t time { 0 };
+        bool reusedMode { false };
+        bool firstFrame { false };
+    } m_startup;
+
     struct {
         PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
         PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
@@ -212,6 +219,12 @@ void ViewBackend::pageFlipHandler(int, unsigned, unsigned sec, unsigned usec, vo
     backend.m_display.current_bo = backend.m_display.next_bo;
     backend.m_display.next_bo = nullptr;
 
+    if (backend.m_display.current_bo && !backend.m_startup.firstFrame) {
+        backend.m_startup.firstFrame = true;
+        fprintf(stderr, "ViewBackend: first frame on screen after %.1f ms%s\n",
+            (g_get_monotonic_time() - backend.m_startup.time) / 1000.0, backend.m_startup.reusedMode ? " (modeset skipped)" : "");
+    }
+
     if (backend.m_display.current_bo) {
         auto* fb = getFBInfo(backend.m_display.current_bo);
         fb->sendFrameCallback((sec * 1000) + (usec / 1000));
@@ -262,6 +275,8 @@ ViewBackend::ViewBackend(struct wpe_view_backend* backend)
     : backend(backend)
     , m_viewDisplay(this)
 {
+    m_startup.time = g_get_monotonic_time();
+
     decltype(m_drm) drm;
     auto drmCleanup = defer(
         [&drm] {
@@ -523,6 +538,14 @@ ViewBackend::ViewBackend(struct wpe_view_backend* backend)
         abort();
     }
 
+    // If the bootloader or a splash screen already set this mode, keep its
+    // framebuffer on screen and flip straight into the first frame instead.
+    m_startup.reusedMode = ::DRM::isOutputActive(m_drm.fd, m_drm.connectorId, m_drm.crtcId, *m_drm.mode);
+    if (m_startup.reusedMode) {
+        fprintf(stderr, "ViewBackend: output already in the selected mode, skipping the modeset\n");
+        return;
+    }
+
     glClear(GL_COLOR_BUFFER_BIT);
     eglSwapBuffers(m_egl.display, m_egl.surface);
 
@@ -609,8 +632,29 @@ void ViewBackend::OnSurfaceCommit(NC::ViewDisplay::Surface const& surface,
         if (frameCallback)
             fb->setFrameCallback(frameCallback->resource());
 
-        drmModePageFlip(m_drm.fd, m_drm.crtcId, fb->getFBID(),
+        int ret = drmModePageFlip(m_drm.fd, m_drm.crtcId, fb->getFBID(),
                 DRM_MODE_PAGE_FLIP_EVENT, this);
+        if (!ret)
+            return;
+
+        int64_t now = g_get_monotonic_time();
+        if (m_startup.reusedMode && !m_startup.firstFrame) {
+            // The state left by the bootloader can't always be flipped from,
+            // in which case the frame is put on screen with a full modeset.
+            fprintf(stderr, "ViewBackend: failed to flip into the existing mode, doing a full modeset\n");
+            m_startup.reusedMode = false;
+            if (!drmModeSetCrtc(m_drm.fd, m_drm.crtcId, fb->getFBID(), 0, 0, &m_drm.connectorId, 1, m_drm.mode)) {
+                pageFlipHandler(m_drm.fd, 0, now / G_USEC_PER_SEC, now % G_USEC_PER_SEC, this);
+                return;
+            }
+        }
+
+        // The frame is dropped, but the client must not be left waiting on it.
+        fprintf(stderr, "ViewBackend: failed to queue page flip: %s\n", strerror(errno));
+        fb->releaseBuffer();
+        fb->sendFrameCallback(now / 1000);
+        gbm_surface_release_buffer(m_gbm.surface, m_display.next_bo);
+        m_display.next_bo = nullptr;
     }
 }
 
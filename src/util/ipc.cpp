@@ -179,6 +179,17 @@ gboolean Client::socketCallback(GSocket* socket, GIOCondition condition, gpointe
     return TRUE;
 }
 
+// Handles whatever the host queued before the client's source got a chance
+// to run, without blocking when nothing is there.
+void Client::dispatchPendingMessages()
+{
+    if (!m_socket)
+        return;
+
+    while (g_socket_condition_check(m_socket, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP)) == G_IO_IN)
+        socketCallback(m_socket, G_IO_IN, this);
+}
+
 void Client::sendFd(int fd)
 {
     GSocketControlMessage* fdMessage = g_unix_fd_message_new();
@@ -87,6 +87,8 @@ public:
     void sendFd(int);
     void sendMessage(char*, size_t);
 
+    void dispatchPendingMessages();
+
 private:
     static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
 
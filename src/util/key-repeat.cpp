@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "key-repeat.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <glib.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace Keyboard {
+
+class KeyRepeat::Source {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+    KeyRepeat* keyRepeat;
+};
+
+GSourceFuncs KeyRepeat::Source::sourceFuncs = {
+    nullptr, // prepare
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto* source = reinterpret_cast<Source*>(base);
+        return !!source->pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<Source*>(base);
+
+        uint64_t expirations = 0;
+        if (source->pfd.revents & G_IO_IN
+            && read(source->pfd.fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            source->keyRepeat->dispatch(expirations);
+
+        source->pfd.revents = 0;
+        return TRUE;
+    },
+    // finalize
+    [](GSource* base)
+    {
+        auto* source = reinterpret_cast<Source*>(base);
+        close(source->pfd.fd);
+    },
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+static struct timespec timespecFromNanoseconds(int64_t nanoseconds)
+{
+    return { static_cast<time_t>(nanoseconds / 1000000000), static_cast<long>(nanoseconds % 1000000000) };
+}
+
+KeyRepeat::KeyRepeat(Handler& handler)
+    : m_handler(handler)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "KeyRepeat: failed to create the timer, keys won't repeat: %s\n", strerror(errno));
+        return;
+    }
+
+    m_source = g_source_new(&Source::sourceFuncs, sizeof(Source));
+    auto* source = reinterpret_cast<Source*>(m_source);
+    source->pfd.fd = fd;
+    source->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source->pfd.revents = 0;
+    source->keyRepeat = this;
+    g_source_add_poll(m_source, &source->pfd);
+
+    g_source_set_name(m_source, "[WPE] Key repeat");
+    g_source_set_priority(m_source, G_PRIORITY_DEFAULT);
+    g_source_set_can_recurse(m_source, TRUE);
+    g_source_attach(m_source, g_main_context_get_thread_default());
+}
+
+KeyRepeat::~KeyRepeat()
+{
+    if (m_source) {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+    }
+}
+
+void KeyRepeat::setInfo(int32_t rate, int32_t delay)
+{
+    m_info = { rate, delay };
+
+    // A rate of zero disables any repeating.
+    if (rate <= 0)
+        stop();
+}
+
+void KeyRepeat::start(uint32_t key, uint32_t state, uint32_t time)
+{
+    if (!m_source || m_info.rate <= 0)
+        return;
+
+    m_data = { key, state, time, 0 };
+
+    // A zero value disarms the timer, so a zero delay becomes the shortest
+    // one instead.
+    struct itimerspec spec;
+    spec.it_value = timespecFromNanoseconds(std::max<int64_t>(1, int64_t(m_info.delay) * 1000000));
+    spec.it_interval = timespecFromNanoseconds(1000000000 / m_info.rate);
+    timerfd_settime(reinterpret_cast<Source*>(m_source)->pfd.fd, 0, &spec, nullptr);
+}
+
+void KeyRepeat::stop()
+{
+    m_data = { 0, 0, 0, 0 };
+
+    // Disarming also drops expirations not read yet.
+    if (!m_source)
+        return;
+    struct itimerspec spec = { };
+    timerfd_settime(reinterpret_cast<Source*>(m_source)->pfd.fd, 0, &spec, nullptr);
+}
+
+void KeyRepeat::dispatch(uint64_t expirations)
+{
+    if (!m_data.key || m_info.rate <= 0)
+        return;
+
+    m_data.count += expirations;
+    uint64_t elapsed = m_info.delay + (m_data.count - 1) * 1000 / m_info.rate;
+    m_handler.repeatKey(m_data.key, m_data.state, m_data.time + elapsed);
+}
+
+} // namespace Keyboard
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_key_repeat_h
+#define wpe_mesa_key_repeat_h
+
+#include <stdint.h>
+
+typedef struct _GSource GSource;
+
+namespace Keyboard {
+
+// Repeats the last key pressed, from a timerfd polled by a GSource in the
+// thread default main context. The timer keeps its phase however late the
+// main loop gets to it, so the repeats stay on time; several periods elapsed
+// at once still make a single repeat, stamped with the time of the last one,
+// rather than a burst.
+class KeyRepeat {
+public:
+    class Handler {
+    public:
+        virtual void repeatKey(uint32_t key, uint32_t state, uint32_t time) = 0;
+    };
+
+    KeyRepeat(Handler&);
+    ~KeyRepeat();
+
+    KeyRepeat(const KeyRepeat&) = delete;
+    KeyRepeat& operator=(const KeyRepeat&) = delete;
+
+    // False when the timer couldn't be created, and keys won't repeat.
+    bool isValid() const { return !!m_source; }
+
+    // The rate is in repeats per second and the delay in milliseconds, as in
+    // wl_keyboard.repeat_info. A zero rate disables repeating.
+    void setInfo(int32_t rate, int32_t delay);
+    bool isEnabled() const { return m_info.rate > 0; }
+
+    uint32_t key() const { return m_data.key; }
+
+    // The time is the one of the key event, which repeats are stamped from.
+    void start(uint32_t key, uint32_t state, uint32_t time);
+    void stop();
+
+private:
+    class Source;
+
+    void dispatch(uint64_t expirations);
+
+    Handler& m_handler;
+    GSource* m_source { nullptr };
+
+    struct {
+        int32_t rate;
+        int32_t delay;
+    } m_info { 0, 0 };
+
+    struct {
+        uint32_t key;
+        uint32_t state;
+        uint32_t time;
+        // Repeat periods elapsed since the delay ran out.
+        uint64_t count;
+    } m_data { 0, 0, 0, 0 };
+};
+
+} // namespace Keyboard
+
+#endif // wpe_mesa_key_repeat_h
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_mesa_latency_histogram_h
+#define wpe_mesa_latency_histogram_h
+
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <stdint.h>
+
+namespace Stats {
+
+// Latencies counted in power-of-two millisecond buckets, from under 1 ms up
+// to 256 ms and above.
+class LatencyHistogram {
+public:
+    void record(uint64_t microseconds)
+    {
+        ++m_count;
+        m_sum += microseconds;
+        if (microseconds > m_max)
+            m_max = microseconds;
+
+        size_t bucket = 0;
+        for (uint64_t milliseconds = microseconds / 1000; milliseconds && bucket < s_bucketCount - 1; milliseconds >>= 1)
+            ++bucket;
+        ++m_buckets[bucket];
+    }
+
+    uint64_t count() const { return m_count; }
+
+    void print(const char* prefix, const char* name) const
+    {
+        if (!m_count)
+            return;
+
+        fprintf(stderr, "%s: %s latency %.2f ms average, %.2f ms max over %" PRIu64 " events:",
+            prefix, name, m_sum / 1000.0 / m_count, m_max / 1000.0, m_count);
+        for (size_t i = 0; i < s_bucketCount; ++i) {
+            if (!m_buckets[i])
+                continue;
+            if (i < s_bucketCount - 1)
+                fprintf(stderr, " <%u ms: %" PRIu64, 1u << i, m_buckets[i]);
+            else
+                fprintf(stderr, " >=%u ms: %" PRIu64, 1u << (i - 1), m_buckets[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+private:
+    static const size_t s_bucketCount = 10;
+
+    std::array<uint64_t, s_bucketCount> m_buckets { };
+    uint64_t m_count { 0 };
+    uint64_t m_sum { 0 };
+    uint64_t m_max { 0 };
+};
+
+} // namespace Stats
+
+#endif // wpe_mesa_latency_histogram_h
@@ -27,16 +27,27 @@
 #include "display.h"
 
 #include "ivi-application-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "xdg-shell-unstable-v6-client-protocol.h"
 #include "wayland-drm-client-protocol.h"
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <errno.h>
 #include <glib.h>
 #include <linux/input.h>
 #include <locale.h>
 #include <memory>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
 #include <wayland-cursor.h>
@@ -44,13 +55,16 @@
 
 namespace Wayland {
 
+// The socket is read by the reader thread, which makes this source ready
+// whenever it queued events that have to be dispatched in the main context.
 class EventSource {
 public:
     static GSourceFuncs sourceFuncs;
 
     GSource source;
-    GPollFD pfd;
     struct wl_display* display;
+    struct wl_event_queue* inputQueue;
+    gint hangup;
 };
 
 GSourceFuncs EventSource::sourceFuncs = {
@@ -62,16 +76,16 @@ GSourceFuncs EventSource::sourceFuncs = {
 
         *timeout = -1;
 
+        wl_display_dispatch_queue_pending(display, source->inputQueue);
         wl_display_dispatch_pending(display);
         wl_display_flush(display);
 
         return FALSE;
     },
     // check
-    [](GSource* base) -> gboolean
+    [](GSource*) -> gboolean
     {
-        auto* source = reinterpret_cast<EventSource*>(base);
-        return !!source->pfd.revents;
+        return FALSE;
     },
     // dispatch
     [](GSource* base, GSourceFunc, gpointer) -> gboolean
@@ -79,13 +93,13 @@ GSourceFuncs EventSource::sourceFuncs = {
         auto* source = reinterpret_cast<EventSource*>(base);
         struct wl_display* display = source->display;
 
-        if (source->pfd.revents & G_IO_IN)
-            wl_display_dispatch(display);
-
-        if (source->pfd.revents & (G_IO_ERR | G_IO_HUP))
+        g_source_set_ready_time(base, -1);
+        if (g_atomic_int_get(&source->hangup))
             return FALSE;
 
-        source->pfd.revents = 0;
+        wl_display_dispatch_queue_pending(display, source->inputQueue);
+        wl_display_dispatch_pending(display);
+        wl_display_flush(display);
         return TRUE;
     },
     nullptr, // finalize
@@ -93,6 +107,14 @@ GSourceFuncs EventSource::sourceFuncs = {
     nullptr, // closure_marshall
 };
 
+static const struct wp_presentation_listener g_presentationListener = {
+    // clock_id
+    [](void* data, struct wp_presentation*, uint32_t clockId)
+    {
+        static_cast<Display::Interfaces*>(data)->presentation_clock_id = clockId;
+    },
+};
+
 const struct wl_registry_listener g_registryListener = {
     // global
     [](void* data, struct wl_registry* registry, uint32_t name, const char* interface, uint32_t version)
@@ -100,7 +122,7 @@ const struct wl_registry_listener g_registryListener = {
         auto& interfaces = *static_cast<Display::Interfaces*>(data);
 
         if (!std::strcmp(interface, "wl_compositor"))
-            interfaces.compositor = static_cast<struct wl_compositor*>(wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+            interfaces.compositor = static_cast<struct wl_compositor*>(wl_registry_bind(registry, name, &wl_compositor_interface, std::min<uint32_t>(version, 4)));
 
         if (!std::strcmp(interface, "wl_data_device_manager"))
             interfaces.data_device_manager = static_cast<struct wl_data_device_manager*>(wl_registry_bind(registry, name, &wl_data_device_manager_interface, 2));
@@ -112,7 +134,7 @@ const struct wl_registry_listener g_registryListener = {
         }
 
         if (!std::strcmp(interface, "wl_seat"))
-            interfaces.seat = static_cast<struct wl_seat*>(wl_registry_bind(registry, name, &wl_seat_interface, 4));
+            interfaces.seat = static_cast<struct wl_seat*>(wl_registry_bind(registry, name, &wl_seat_interface, std::min<uint32_t>(version, 5)));
 
         if (!std::strcmp(interface, "xdg_shell"))
             interfaces.xdg = static_cast<struct xdg_shell*>(wl_registry_bind(registry, name, &xdg_shell_interface, 1));
@@ -125,6 +147,23 @@ const struct wl_registry_listener g_registryListener = {
 
         if (!std::strcmp(interface, "wl_shm"))
             interfaces.shm = static_cast<struct wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+
+        // create_immed arrived with version 2, and is the only import path used.
+        // Version 4 adds per-surface allocation feedback.
+        if (!std::strcmp(interface, "zwp_linux_dmabuf_v1") && version >= 2)
+            interfaces.linux_dmabuf = static_cast<struct zwp_linux_dmabuf_v1*>(wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, std::min<uint32_t>(version, 4)));
+
+        if (!std::strcmp(interface, "wp_presentation")) {
+            interfaces.presentation = static_cast<struct wp_presentation*>(wl_registry_bind(registry, name, &wp_presentation_interface, 1));
+            interfaces.presentation_clock_id = CLOCK_MONOTONIC;
+            wp_presentation_add_listener(interfaces.presentation, &g_presentationListener, data);
+        }
+
+        if (!std::strcmp(interface, "wp_viewporter"))
+            interfaces.viewporter = static_cast<struct wp_viewporter*>(wl_registry_bind(registry, name, &wp_viewporter_interface, 1));
+
+        if (!std::strcmp(interface, "wl_subcompositor"))
+            interfaces.subcompositor = static_cast<struct wl_subcompositor*>(wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
     },
     // global_remove
     [](void*, struct wl_registry*, uint32_t) { },
@@ -146,6 +185,68 @@ static const struct zxdg_shell_v6_listener g_xdg6ShellListener = {
     },
 };
 
+// Timestamps are in milliseconds of the compositor's clock, which is
+// CLOCK_MONOTONIC in practice; latencies too large for that are dropped.
+static void recordInputLatency(Display::SeatData& seatData, Display::SeatData::InputType type, struct wpe_view_backend* backend, uint32_t time)
+{
+    auto& latency = seatData.latency;
+    if (!latency.enabled)
+        return;
+
+    uint32_t now = g_get_monotonic_time() / 1000;
+    uint32_t elapsed = now - time;
+    if (elapsed < 10000)
+        latency.dispatch[type].record(uint64_t(elapsed) * 1000);
+    latency.pending.insert({ backend, time });
+}
+
+static int32_t scaleCoordinate(const Display::SeatData& seatData, struct wl_surface* surface, wl_fixed_t value)
+{
+    auto it = seatData.inputScales.find(surface);
+    if (it == seatData.inputScales.end())
+        return wl_fixed_to_int(value);
+    return wl_fixed_to_double(value) * it->second;
+}
+
+// Motion is coalesced into one event per frame, and scrolling into one event
+// per axis, keeping fractions of a unit from smooth sources for later frames.
+static void dispatchPointerFrame(Display::SeatData& seatData)
+{
+    auto& pointer = seatData.pointer;
+    auto pending = pointer.pending;
+    pointer.pending = { };
+    if (!pointer.target.first)
+        return;
+
+    struct wpe_view_backend* backend = pointer.target.second;
+    int32_t x = scaleCoordinate(seatData, pointer.target.first, pointer.coords.first);
+    int32_t y = scaleCoordinate(seatData, pointer.target.first, pointer.coords.second);
+
+    if (pending.motion) {
+        struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_motion, pending.time, x, y, pointer.button, pointer.state };
+        wpe_view_backend_dispatch_pointer_event(backend, &event);
+        recordInputLatency(seatData, Display::SeatData::PointerMotion, backend, pending.time);
+    }
+
+    for (uint32_t axis = 0; axis < pending.axisValues.size(); ++axis) {
+        if (!(pending.axes & (1 << axis)))
+            continue;
+
+        // Wheel clicks are whole steps, with nothing to carry over.
+        wl_fixed_t value = pending.axisValues[axis];
+        if (!pending.axisDiscrete[axis])
+            value += pointer.axisRemainders[axis];
+        int32_t units = wl_fixed_to_int(value);
+        pointer.axisRemainders[axis] = value - wl_fixed_from_int(units);
+        if (!units)
+            continue;
+
+        struct wpe_input_axis_event event = { wpe_input_axis_event_type_motion, pending.axisTime, x, y, axis, -units };
+        wpe_view_backend_dispatch_axis_event(backend, &event);
+        recordInputLatency(seatData, Display::SeatData::PointerAxis, backend, pending.axisTime);
+    }
+}
+
 static const struct wl_pointer_listener g_pointerListener = {
     // enter
     [](void* data, struct wl_pointer* pointer, uint32_t serial, struct wl_surface* surface, wl_fixed_t, wl_fixed_t)
@@ -155,6 +256,8 @@ static const struct wl_pointer_listener g_pointerListener = {
         auto it = seatData.inputClients.find(surface);
         if (it != seatData.inputClients.end())
             seatData.pointer.target = *it;
+        seatData.pointer.pending = { };
+        seatData.pointer.axisRemainders = { };
 
         if (seatData.cursor.cursor && seatData.cursor.surface) {
             struct wl_cursor_image* image = seatData.cursor.cursor->images[0];
@@ -178,22 +281,19 @@ static const struct wl_pointer_listener g_pointerListener = {
         auto it = seatData.inputClients.find(surface);
         if (it != seatData.inputClients.end() && seatData.pointer.target.first == it->first)
             seatData.pointer.target = { nullptr, nullptr };
+        seatData.pointer.pending = { };
     },
     // motion
     [](void* data, struct wl_pointer*, uint32_t time, wl_fixed_t fixedX, wl_fixed_t fixedY)
     {
-        auto x = wl_fixed_to_int(fixedX);
-        auto y = wl_fixed_to_int(fixedY);
-
-        auto& pointer = static_cast<Display::SeatData*>(data)->pointer;
-        pointer.coords = { x, y };
-
-        if (pointer.target.first) {
-            struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_motion, time, x, y, pointer.button, pointer.state };
+        auto& seatData = *static_cast<Display::SeatData*>(data);
+        auto& pointer = seatData.pointer;
+        pointer.coords = { fixedX, fixedY };
+        pointer.pending.motion = true;
+        pointer.pending.time = time;
 
-            struct wpe_view_backend* backend = pointer.target.second;
-            wpe_view_backend_dispatch_pointer_event(backend, &event);
-        }
+        if (!pointer.frames)
+            dispatchPointerFrame(seatData);
     },
     // button
     [](void* data, struct wl_pointer*, uint32_t serial, uint32_t time, uint32_t button, uint32_t state)
@@ -205,31 +305,60 @@ static const struct wl_pointer_listener g_pointerListener = {
         else
             button = 0;
 
-        auto& pointer = static_cast<Display::SeatData*>(data)->pointer;
-        auto& coords = pointer.coords;
+        // The button goes after the motion that led to it.
+        auto& seatData = *static_cast<Display::SeatData*>(data);
+        dispatchPointerFrame(seatData);
 
+        auto& pointer = seatData.pointer;
         pointer.button = !!state ? button : 0;
         pointer.state = state;
 
         if (pointer.target.first) {
-            struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_button, time, coords.first, coords.second, button, state };
+            int32_t x = scaleCoordinate(seatData, pointer.target.first, pointer.coords.first);
+            int32_t y = scaleCoordinate(seatData, pointer.target.first, pointer.coords.second);
+            struct wpe_input_pointer_event event = { wpe_input_pointer_event_type_button, time, x, y, button, state };
 
             struct wpe_view_backend* backend = pointer.target.second;
             wpe_view_backend_dispatch_pointer_event(backend, &event);
+            recordInputLatency(seatData, Display::SeatData::PointerButton, backend, time);
         }
     },
     // axis
     [](void* data, struct wl_pointer*, uint32_t time, uint32_t axis, wl_fixed_t value)
     {
-        auto& pointer = static_cast<Display::SeatData*>(data)->pointer;
-        auto& coords = pointer.coords;
+        auto& seatData = *static_cast<Display::SeatData*>(data);
+        auto& pending = seatData.pointer.pending;
+        if (axis >= pending.axisValues.size())
+            return;
 
-        if (pointer.target.first) {
-            struct wpe_input_axis_event event = { wpe_input_axis_event_type_motion, time, coords.first, coords.second, axis, -wl_fixed_to_int(value) };
+        pending.axes |= 1 << axis;
+        pending.axisTime = time;
+        pending.axisValues[axis] += value;
 
-            struct wpe_view_backend* backend = pointer.target.second;
-            wpe_view_backend_dispatch_axis_event(backend, &event);
-        }
+        if (!seatData.pointer.frames)
+            dispatchPointerFrame(seatData);
+    },
+    // frame
+    [](void* data, struct wl_pointer*)
+    {
+        dispatchPointerFrame(*static_cast<Display::SeatData*>(data));
+    },
+    // axis_source
+    // Sources only differ in whether they send discrete steps, which tell already.
+    [](void*, struct wl_pointer*, uint32_t) { },
+    // axis_stop
+    [](void* data, struct wl_pointer*, uint32_t, uint32_t axis)
+    {
+        auto& pointer = static_cast<Display::SeatData*>(data)->pointer;
+        if (axis < pointer.axisRemainders.size())
+            pointer.axisRemainders[axis] = 0;
+    },
+    // axis_discrete
+    [](void* data, struct wl_pointer*, uint32_t axis, int32_t discrete)
+    {
+        auto& pending = static_cast<Display::SeatData*>(data)->pointer.pending;
+        if (axis < pending.axisDiscrete.size())
+            pending.axisDiscrete[axis] += discrete;
     },
 };
 
@@ -256,24 +385,6 @@ handleKeyEvent(Display::SeatData& seatData, uint32_t key, uint32_t state, uint32
         wpe_view_backend_dispatch_keyboard_event(backend, &event);
     }
 }
-
-static gboolean
-repeatRateTimeout(void* data)
-{
-    auto& seatData = *static_cast<Display::SeatData*>(data);
-    handleKeyEvent(seatData, seatData.repeatData.key, seatData.repeatData.state, seatData.repeatData.time);
-    return G_SOURCE_CONTINUE;
-}
-
-static gboolean
-repeatDelayTimeout(void* data)
-{
-    auto& seatData = *static_cast<Display::SeatData*>(data);
-    handleKeyEvent(seatData, seatData.repeatData.key, seatData.repeatData.state, seatData.repeatData.time);
-    seatData.repeatData.eventSource = g_timeout_add(seatData.repeatInfo.rate, static_cast<GSourceFunc>(repeatRateTimeout), data);
-    return G_SOURCE_REMOVE;
-}
-
 static const struct wl_keyboard_listener g_keyboardListener = {
     // keymap
     [](void* data, struct wl_keyboard*, uint32_t format, int fd, uint32_t size)
@@ -311,6 +422,7 @@ static const struct wl_keyboard_listener g_keyboardListener = {
     {
         auto& seatData = *static_cast<Display::SeatData*>(data);
         seatData.serial = serial;
+        seatData.keyRepeat->stop();
         auto it = seatData.inputClients.find(surface);
         if (it != seatData.inputClients.end())
             seatData.keyboard.target = *it;
@@ -320,6 +432,7 @@ static const struct wl_keyboard_listener g_keyboardListener = {
     {
         auto& seatData = *static_cast<Display::SeatData*>(data);
         seatData.serial = serial;
+        seatData.keyRepeat->stop();
         auto it = seatData.inputClients.find(surface);
         if (it != seatData.inputClients.end() && seatData.keyboard.target.first == it->first)
             seatData.keyboard.target = { nullptr, nullptr };
@@ -333,23 +446,19 @@ static const struct wl_keyboard_listener g_keyboardListener = {
         auto& seatData = *static_cast<Display::SeatData*>(data);
         seatData.serial = serial;
         handleKeyEvent(seatData, key, state, time);
+        if (seatData.keyboard.target.first)
+            recordInputLatency(seatData, Display::SeatData::Keyboard, seatData.keyboard.target.second, time);
 
-        if (!seatData.repeatInfo.rate)
+        auto& keyRepeat = *seatData.keyRepeat;
+        if (!keyRepeat.isEnabled())
             return;
 
         if (state == WL_KEYBOARD_KEY_STATE_RELEASED
-            && seatData.repeatData.key == key) {
-            if (seatData.repeatData.eventSource)
-                g_source_remove(seatData.repeatData.eventSource);
-            seatData.repeatData = { 0, 0, 0, 0 };
-        } else if (state == WL_KEYBOARD_KEY_STATE_PRESSED
-            && xkb_keymap_key_repeats(seatData.xkb.keymap, key)) {
-
-            if (seatData.repeatData.eventSource)
-                g_source_remove(seatData.repeatData.eventSource);
-
-            seatData.repeatData = { key, time, state, g_timeout_add(seatData.repeatInfo.delay, static_cast<GSourceFunc>(repeatDelayTimeout), data) };
-        }
+            && keyRepeat.key() == key)
+            keyRepeat.stop();
+        else if (state == WL_KEYBOARD_KEY_STATE_PRESSED
+            && xkb_keymap_key_repeats(seatData.xkb.keymap, key))
+            keyRepeat.start(key, state, time);
     },
     // modifiers
     [](void* data, struct wl_keyboard*, uint32_t serial, uint32_t depressedMods, uint32_t latchedMods, uint32_t lockedMods, uint32_t group)
@@ -371,20 +480,58 @@ static const struct wl_keyboard_listener g_keyboardListener = {
     // repeat_info
     [](void* data, struct wl_keyboard*, int32_t rate, int32_t delay)
     {
-        auto& repeatInfo = static_cast<Display::SeatData*>(data)->repeatInfo;
-        repeatInfo = { rate, delay };
-
-        // A rate of zero disables any repeating.
-        if (!rate) {
-            auto& repeatData = static_cast<Display::SeatData*>(data)->repeatData;
-            if (repeatData.eventSource) {
-                g_source_remove(repeatData.eventSource);
-                repeatData = { 0, 0, 0, 0 };
-            }
-        }
+        static_cast<Display::SeatData*>(data)->keyRepeat->setInfo(rate, delay);
     },
 };
 
+// Everything that changed within a frame goes out as a single event for each
+// view touched, listing only the points on that view, and typed after the
+// last point that changed there.
+static void dispatchTouchFrame(Display::SeatData& seatData)
+{
+    auto& touch = seatData.touch;
+    const size_t count = touch.targets.size();
+
+    std::array<struct wpe_view_backend*, 10> backends;
+    size_t backendCount = 0;
+    for (size_t id = 0; id < count; ++id) {
+        struct wpe_view_backend* backend = touch.targets[id].second;
+        if (!(touch.changed & (1 << id)) || !backend)
+            continue;
+        if (std::find(backends.begin(), backends.begin() + backendCount, backend) == backends.begin() + backendCount)
+            backends[backendCount++] = backend;
+    }
+
+    std::array<struct wpe_input_touch_event_raw, 10> points;
+    for (size_t i = 0; i < backendCount; ++i) {
+        struct wpe_view_backend* backend = backends[i];
+
+        size_t pointCount = 0;
+        int32_t lastId = -1;
+        for (size_t id = 0; id < count; ++id) {
+            if (touch.targets[id].second != backend || touch.touchPoints[id].type == wpe_input_touch_event_type_null)
+                continue;
+            points[pointCount++] = touch.touchPoints[id];
+            if (touch.changed & (1 << id) && (lastId == -1 || int32_t(id) == touch.lastId))
+                lastId = id;
+        }
+
+        auto& last = touch.touchPoints[lastId];
+        struct wpe_input_touch_event event = { points.data(), pointCount, last.type, lastId, last.time };
+        wpe_view_backend_dispatch_touch_event(backend, &event);
+        recordInputLatency(seatData, Display::SeatData::Touch, backend, last.time);
+    }
+
+    for (size_t id = 0; id < count; ++id) {
+        if (!(touch.released & (1 << id)))
+            continue;
+        touch.touchPoints[id] = { wpe_input_touch_event_type_null, 0, 0, 0, 0 };
+        touch.targets[id] = { nullptr, nullptr };
+    }
+    touch.changed = 0;
+    touch.released = 0;
+}
+
 static const struct wl_touch_listener g_touchListener = {
     // down
     [](void* data, struct wl_touch*, uint32_t serial, uint32_t time, struct wl_surface* surface, int32_t id, wl_fixed_t x, wl_fixed_t y)
@@ -405,13 +552,11 @@ static const struct wl_touch_listener g_touchListener = {
 
         target = { surface, it->second };
 
-        auto& touchPoints = seatData.touch.touchPoints;
-        touchPoints[id] = { wpe_input_touch_event_type_down, time, id, wl_fixed_to_int(x), wl_fixed_to_int(y) };
-
-        struct wpe_input_touch_event event = { touchPoints.data(), touchPoints.size(), wpe_input_touch_event_type_down, id, time };
-
-        struct wpe_view_backend* backend = target.second;
-        wpe_view_backend_dispatch_touch_event(backend, &event);
+        auto& touch = seatData.touch;
+        touch.touchPoints[id] = { wpe_input_touch_event_type_down, time, id,
+            scaleCoordinate(seatData, surface, x), scaleCoordinate(seatData, surface, y) };
+        touch.changed |= 1 << id;
+        touch.lastId = id;
     },
     // up
     [](void* data, struct wl_touch*, uint32_t serial, uint32_t time, int32_t id)
@@ -423,20 +568,15 @@ static const struct wl_touch_listener g_touchListener = {
         if (id < 0 || id >= arraySize)
             return;
 
-        auto& target = seatData.touch.targets[id];
-        assert(target.first && target.second);
+        auto& touch = seatData.touch;
+        if (!touch.targets[id].first)
+            return;
 
-        auto& touchPoints = seatData.touch.touchPoints;
-        auto& point = touchPoints[id];
+        auto& point = touch.touchPoints[id];
         point = { wpe_input_touch_event_type_up, time, id, point.x, point.y };
-
-        struct wpe_input_touch_event event = { touchPoints.data(), touchPoints.size(), wpe_input_touch_event_type_up, id, time };
-
-        struct wpe_view_backend* backend = target.second;
-        wpe_view_backend_dispatch_touch_event(backend, &event);
-
-        point = { wpe_input_touch_event_type_null, 0, 0, 0, 0 };
-        target = { nullptr, nullptr };
+        touch.changed |= 1 << id;
+        touch.released |= 1 << id;
+        touch.lastId = id;
     },
     // motion
     [](void* data, struct wl_touch*, uint32_t time, int32_t id, wl_fixed_t x, wl_fixed_t y)
@@ -447,26 +587,32 @@ static const struct wl_touch_listener g_touchListener = {
         if (id < 0 || id >= arraySize)
             return;
 
-        auto& target = seatData.touch.targets[id];
-        assert(target.first && target.second);
-
-        auto& touchPoints = seatData.touch.touchPoints;
-        touchPoints[id] = { wpe_input_touch_event_type_motion, time, id, wl_fixed_to_int(x), wl_fixed_to_int(y) };
-
-        struct wpe_input_touch_event event = { touchPoints.data(), touchPoints.size(), wpe_input_touch_event_type_motion, id, time };
+        auto& touch = seatData.touch;
+        if (!touch.targets[id].first)
+            return;
 
-        struct wpe_view_backend* backend = target.second;
-        wpe_view_backend_dispatch_touch_event(backend, &event);
+        struct wl_surface* surface = touch.targets[id].first;
+        touch.touchPoints[id] = { wpe_input_touch_event_type_motion, time, id,
+            scaleCoordinate(seatData, surface, x), scaleCoordinate(seatData, surface, y) };
+        touch.changed |= 1 << id;
+        touch.lastId = id;
     },
     // frame
-    [](void*, struct wl_touch*)
+    [](void* data, struct wl_touch*)
     {
-        // FIXME: Dispatching events via frame() would avoid dispatching events
-        // for every single event that's encapsulated in a frame with multiple
-        // other events.
+        dispatchTouchFrame(*static_cast<Display::SeatData*>(data));
     },
     // cancel
-    [](void*, struct wl_touch*) { },
+    // The compositor took the sequence over; WPE has no way to tell, so the
+    // points are only forgotten.
+    [](void* data, struct wl_touch*)
+    {
+        auto& touch = static_cast<Display::SeatData*>(data)->touch;
+        touch.targets = { };
+        touch.touchPoints = { };
+        touch.changed = 0;
+        touch.released = 0;
+    },
 };
 
 static const struct wl_seat_listener g_seatListener = {
@@ -479,6 +625,7 @@ static const struct wl_seat_listener g_seatListener = {
         const bool hasPointerCap = capabilities & WL_SEAT_CAPABILITY_POINTER;
         if (hasPointerCap && !seatData.pointer.object) {
             seatData.pointer.object = wl_seat_get_pointer(seat);
+            seatData.pointer.frames = wl_pointer_get_version(seatData.pointer.object) >= WL_POINTER_FRAME_SINCE_VERSION;
             wl_pointer_add_listener(seatData.pointer.object, &g_pointerListener, &seatData);
         }
         if (!hasPointerCap && seatData.pointer.object) {
@@ -526,14 +673,20 @@ Display::Display()
     wl_registry_add_listener(m_registry, &g_registryListener, &m_interfaces);
     wl_display_roundtrip(m_display);
 
+    // Input devices are created from the seat, and inherit its queue. The
+    // listener has to be there before the capabilities are sent on binding.
+    m_inputQueue = wl_display_create_queue(m_display);
+    wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(m_interfaces.seat), m_inputQueue);
+    wl_seat_add_listener(m_interfaces.seat, &g_seatListener, &m_seatData);
+
+    // Another roundtrip for the events sent on binding, like the presentation clock.
+    wl_display_roundtrip(m_display);
+
     m_eventSource = g_source_new(&EventSource::sourceFuncs, sizeof(EventSource));
     auto* source = reinterpret_cast<EventSource*>(m_eventSource);
     source->display = m_display;
-
-    source->pfd.fd = wl_display_get_fd(m_display);
-    source->pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
-    source->pfd.revents = 0;
-    g_source_add_poll(m_eventSource, &source->pfd);
+    source->inputQueue = m_inputQueue;
+    source->hangup = 0;
 
     g_source_set_name(m_eventSource, "[WPE] Display");
     g_source_set_priority(m_eventSource, G_PRIORITY_HIGH + 30);
@@ -548,16 +701,51 @@ Display::Display()
     if (m_interfaces.xdg_v6)
         zxdg_shell_v6_add_listener(m_interfaces.xdg_v6, &g_xdg6ShellListener, nullptr);
 
-    wl_seat_add_listener(m_interfaces.seat, &g_seatListener, &m_seatData);
-
     m_seatData.xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     m_seatData.xkb.composeTable = xkb_compose_table_new_from_locale(m_seatData.xkb.context, setlocale(LC_CTYPE, nullptr), XKB_COMPOSE_COMPILE_NO_FLAGS);
     if (m_seatData.xkb.composeTable)
         m_seatData.xkb.composeState = xkb_compose_state_new(m_seatData.xkb.composeTable, XKB_COMPOSE_STATE_NO_FLAGS);
+
+    // The first view keeps the historical pid-based id. Further views are
+    // spaced by the largest pid Linux hands out, so they can't collide with
+    // the views of other processes. WPE_WAYLAND_IVI_ID sets the first id
+    // instead, for shells configured with fixed ones, numbering the next
+    // views after it.
+    m_iviIds.base = 4200 + getpid();
+    m_iviIds.stride = 1 << 22;
+    if (const char* iviId = getenv("WPE_WAYLAND_IVI_ID")) {
+        char* end = nullptr;
+        unsigned long value = strtoul(iviId, &end, 10);
+        if (end != iviId && !*end && value <= UINT32_MAX) {
+            m_iviIds.base = value;
+            m_iviIds.stride = 1;
+        } else
+            fprintf(stderr, "Display: invalid WPE_WAYLAND_IVI_ID '%s'\n", iviId);
+    }
+
+    m_seatData.latency.enabled = !!getenv("WPE_MESA_STATS");
+
+    m_seatData.keyRepeat.reset(new Keyboard::KeyRepeat(*this));
+
+    // Handle the seat capabilities, queued during the second roundtrip.
+    wl_display_roundtrip_queue(m_display, m_inputQueue);
+
+    startReader();
 }
 
 Display::~Display()
 {
+    stopReader();
+
+    if (getenv("WPE_MESA_STATS")) {
+        fprintf(stderr, "Display: reader thread woke %" PRIu64 " times, main context %" PRIu64 " times, for at most %zu views\n",
+            uint64_t(m_reader.stats.wakeups), uint64_t(m_reader.stats.mainWakeups), m_reader.stats.maxViews);
+
+        static const char* inputTypeNames[] = { "pointer motion", "pointer button", "pointer axis", "keyboard", "touch" };
+        for (size_t i = 0; i < m_seatData.latency.dispatch.size(); ++i)
+            m_seatData.latency.dispatch[i].print("Display", inputTypeNames[i]);
+    }
+
     if (m_eventSource) {
         g_source_destroy(m_eventSource);
         g_source_unref(m_eventSource);
@@ -583,7 +771,15 @@ Display::~Display()
         ivi_application_destroy(m_interfaces.ivi_application);
     if (m_interfaces.shm)
         wl_shm_destroy(m_interfaces.shm);
-    m_interfaces = { nullptr, nullptr, nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr };
+    if (m_interfaces.linux_dmabuf)
+        zwp_linux_dmabuf_v1_destroy(m_interfaces.linux_dmabuf);
+    if (m_interfaces.presentation)
+        wp_presentation_destroy(m_interfaces.presentation);
+    if (m_interfaces.viewporter)
+        wp_viewporter_destroy(m_interfaces.viewporter);
+    if (m_interfaces.subcompositor)
+        wl_subcompositor_destroy(m_interfaces.subcompositor);
+    m_interfaces = { nullptr, nullptr, nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, nullptr, nullptr };
 
     if (m_registry)
         wl_registry_destroy(m_registry);
@@ -605,22 +801,33 @@ Display::~Display()
         xkb_compose_table_unref(m_seatData.xkb.composeTable);
     if (m_seatData.xkb.composeState)
         xkb_compose_state_unref(m_seatData.xkb.composeState);
-    if (m_seatData.repeatData.eventSource)
-        g_source_remove(m_seatData.repeatData.eventSource);
     m_seatData = SeatData{ };
 
+    if (m_inputQueue)
+        wl_event_queue_destroy(m_inputQueue);
+    m_inputQueue = nullptr;
+
     if (m_display)
         wl_display_disconnect(m_display);
     m_display = nullptr;
 }
 
-void Display::registerInputClient(struct wl_surface* surface, struct wpe_view_backend* client)
+void Display::registerInputClient(struct wl_surface* surface, struct wpe_view_backend* client, double scale)
 {
 #ifndef NDEBUG
     auto result =
 #endif
         m_seatData.inputClients.insert({ surface, client });
     assert(result.second);
+    setInputScale(surface, scale);
+}
+
+void Display::setInputScale(struct wl_surface* surface, double scale)
+{
+    if (scale < 1)
+        m_seatData.inputScales[surface] = scale;
+    else
+        m_seatData.inputScales.erase(surface);
 }
 
 void Display::unregisterInputClient(struct wl_surface* surface)
@@ -630,11 +837,53 @@ void Display::unregisterInputClient(struct wl_surface* surface)
 
     if (m_seatData.pointer.target.first == it->first)
         m_seatData.pointer.target = { nullptr, nullptr };
-    if (m_seatData.keyboard.target.first == it->first)
+    if (m_seatData.keyboard.target.first == it->first) {
         m_seatData.keyboard.target = { nullptr, nullptr };
+        m_seatData.keyRepeat->stop();
+    }
+    auto& touch = m_seatData.touch;
+    for (size_t id = 0; id < touch.targets.size(); ++id) {
+        if (touch.targets[id].first != it->first)
+            continue;
+        touch.targets[id] = { nullptr, nullptr };
+        touch.touchPoints[id] = { wpe_input_touch_event_type_null, 0, 0, 0, 0 };
+        touch.changed &= ~(1 << id);
+        touch.released &= ~(1 << id);
+    }
+    m_seatData.latency.pending.erase(it->second);
+    m_seatData.inputScales.erase(surface);
     m_seatData.inputClients.erase(it);
 }
 
+bool Display::takeInputTime(struct wpe_view_backend* backend, uint32_t& time)
+{
+    auto it = m_seatData.latency.pending.find(backend);
+    if (it == m_seatData.latency.pending.end())
+        return false;
+
+    time = it->second;
+    m_seatData.latency.pending.erase(it);
+    return true;
+}
+
+uint32_t Display::allocateIviId()
+{
+    auto& used = m_iviIds.used;
+    size_t index = std::find(used.begin(), used.end(), false) - used.begin();
+    if (index == used.size())
+        used.push_back(true);
+    else
+        used[index] = true;
+    return m_iviIds.base + index * m_iviIds.stride;
+}
+
+void Display::releaseIviId(uint32_t id)
+{
+    size_t index = (id - m_iviIds.base) / m_iviIds.stride;
+    if (index < m_iviIds.used.size())
+        m_iviIds.used[index] = false;
+}
+
 void Display::setCursor(struct wl_cursor* cursor)
 {
     m_seatData.cursor.cursor = cursor;
@@ -642,4 +891,135 @@ void Display::setCursor(struct wl_cursor* cursor)
         m_seatData.cursor.surface = wl_compositor_create_surface(m_interfaces.compositor);
 }
 
+struct wl_event_queue* Display::createViewQueue()
+{
+    std::lock_guard<std::mutex> lock(m_reader.lock);
+    struct wl_event_queue* queue = wl_display_create_queue(m_display);
+    m_reader.viewQueues.push_back(queue);
+    m_reader.stats.maxViews = std::max(m_reader.stats.maxViews, m_reader.viewQueues.size());
+    return queue;
+}
+
+void Display::destroyViewQueue(struct wl_event_queue* queue)
+{
+    std::lock_guard<std::mutex> lock(m_reader.lock);
+    auto& viewQueues = m_reader.viewQueues;
+    viewQueues.erase(std::remove(viewQueues.begin(), viewQueues.end(), queue), viewQueues.end());
+    wl_event_queue_destroy(queue);
+}
+
+void Display::roundtrip()
+{
+    wl_display_roundtrip(m_display);
+    wakeReader();
+}
+
+void Display::repeatKey(uint32_t key, uint32_t state, uint32_t time)
+{
+    handleKeyEvent(m_seatData, key, state, time);
+}
+
+void Display::startReader()
+{
+    m_reader.wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_reader.wakeFd < 0) {
+        fprintf(stderr, "Display: failed to create the reader wake-up eventfd: %s\n", strerror(errno));
+        return;
+    }
+
+    m_reader.queue = wl_display_create_queue(m_display);
+    m_reader.quit = false;
+    m_reader.thread = std::thread(&Display::readerLoop, this);
+}
+
+void Display::stopReader()
+{
+    if (m_reader.thread.joinable()) {
+        m_reader.quit = true;
+        wakeReader();
+        m_reader.thread.join();
+    }
+
+    if (m_reader.queue)
+        wl_event_queue_destroy(m_reader.queue);
+    m_reader.queue = nullptr;
+    if (m_reader.wakeFd >= 0)
+        close(m_reader.wakeFd);
+    m_reader.wakeFd = -1;
+}
+
+void Display::wakeReader()
+{
+    if (m_reader.wakeFd < 0)
+        return;
+
+    uint64_t value = 1;
+    ssize_t result = write(m_reader.wakeFd, &value, sizeof(value));
+    (void)result;
+}
+
+void Display::readerLoop()
+{
+    struct pollfd fds[2] = {
+        { wl_display_get_fd(m_display), POLLIN, 0 },
+        { m_reader.wakeFd, POLLIN, 0 },
+    };
+
+    // Preparing a read fails while the queue holds events, which tells
+    // whether there is anything for the main context without dispatching it.
+    auto hasEvents = [this](struct wl_event_queue* queue) -> bool {
+        if (queue ? wl_display_prepare_read_queue(m_display, queue) : wl_display_prepare_read(m_display))
+            return true;
+        wl_display_cancel_read(m_display);
+        return false;
+    };
+
+    while (!m_reader.quit) {
+        {
+            std::lock_guard<std::mutex> lock(m_reader.lock);
+            for (auto* queue : m_reader.viewQueues)
+                wl_display_dispatch_queue_pending(m_display, queue);
+        }
+
+        while (wl_display_prepare_read_queue(m_display, m_reader.queue))
+            wl_display_dispatch_queue_pending(m_display, m_reader.queue);
+        // Requests sent from the view queue listeners, like buffer destruction.
+        wl_display_flush(m_display);
+
+        if (poll(fds, 2, -1) < 0) {
+            wl_display_cancel_read(m_display);
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Display: polling the Wayland socket failed: %s\n", strerror(errno));
+            break;
+        }
+        ++m_reader.stats.wakeups;
+
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(m_display) < 0)
+                break;
+        } else
+            wl_display_cancel_read(m_display);
+
+        if (fds[0].revents & (POLLERR | POLLHUP))
+            break;
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            ssize_t result = read(m_reader.wakeFd, &value, sizeof(value));
+            (void)result;
+        }
+
+        if (hasEvents(m_inputQueue) || hasEvents(nullptr)) {
+            ++m_reader.stats.mainWakeups;
+            g_source_set_ready_time(m_eventSource, 0);
+        }
+    }
+
+    if (!m_reader.quit) {
+        g_atomic_int_set(&reinterpret_cast<EventSource*>(m_eventSource)->hangup, 1);
+        g_source_set_ready_time(m_eventSource, 0);
+    }
+}
+
 } // namespace Wayland
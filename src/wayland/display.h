@@ -27,9 +27,16 @@
 #ifndef wpe_view_backend_wayland_display_h
 #define wpe_view_backend_wayland_display_h
 
+#include "key-repeat.h"
+#include "latency-histogram.h"
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 #include <wpe/wpe.h>
 #include <xkbcommon/xkbcommon-compose.h>
 #include <xkbcommon/xkbcommon.h>
@@ -42,21 +49,26 @@ struct wl_cursor;
 struct wl_data_device_manager;
 struct wl_display;
 struct wl_drm;
+struct wl_event_queue;
 struct wl_keyboard;
 struct wl_pointer;
 struct wl_registry;
 struct wl_seat;
 struct wl_shm;
+struct wl_subcompositor;
 struct wl_surface;
 struct wl_touch;
+struct wp_presentation;
+struct wp_viewporter;
 struct xdg_shell;
+struct zwp_linux_dmabuf_v1;
 struct zxdg_shell_v6;
 
 typedef struct _GSource GSource;
 
 namespace Wayland {
 
-class Display {
+class Display : public Keyboard::KeyRepeat::Handler {
 public:
     static Display& singleton();
 
@@ -76,19 +88,43 @@ public:
         struct zxdg_shell_v6* xdg_v6;
         struct ivi_application* ivi_application;
         struct wl_shm* shm;
+        struct zwp_linux_dmabuf_v1* linux_dmabuf;
+        struct wp_presentation* presentation;
+        uint32_t presentation_clock_id;
+        struct wp_viewporter* viewporter;
+        struct wl_subcompositor* subcompositor;
     };
     const Interfaces& interfaces() const { return m_interfaces; }
 
     struct SeatData {
         std::unordered_map<struct wl_surface*, struct wpe_view_backend*> inputClients;
+        // Views rendering below their surface size take input scaled down to
+        // match. Only scales below 1 are kept.
+        std::unordered_map<struct wl_surface*, double> inputScales;
+
+        // Pointer events accumulated until wl_pointer.frame, sent by seats
+        // from version 5 onwards. Axis values are in wl_fixed_t.
+        struct PointerFrame {
+            bool motion;
+            uint32_t time;
+            uint32_t axes;
+            uint32_t axisTime;
+            std::array<int32_t, 2> axisValues;
+            std::array<int32_t, 2> axisDiscrete;
+        };
 
         struct {
             struct wl_pointer* object;
             std::pair<struct wl_surface*, struct wpe_view_backend*> target;
+            // In surface coordinates, as wl_fixed_t.
             std::pair<int, int> coords;
             uint32_t button;
             uint32_t state;
-        } pointer { nullptr, { }, { 0, 0 }, 0, 0 };
+            bool frames;
+            PointerFrame pending;
+            // Scrolling below a whole unit, carried over to the next frame.
+            std::array<int32_t, 2> axisRemainders;
+        } pointer { nullptr, { }, { 0, 0 }, 0, 0, false, { }, { } };
         struct {
             struct wl_keyboard* object;
             std::pair<struct wl_surface*, struct wpe_view_backend*> target;
@@ -97,7 +133,12 @@ public:
             struct wl_touch* object;
             std::array<std::pair<struct wl_surface*, struct wpe_view_backend*>, 10> targets;
             std::array<struct wpe_input_touch_event_raw, 10> touchPoints;
-        } touch { nullptr, { }, { } };
+            // Points changed since the last wl_touch.frame, and those of them
+            // lifted, as bitmasks of ids.
+            uint32_t changed;
+            uint32_t released;
+            int32_t lastId;
+        } touch { nullptr, { }, { }, 0, 0, 0 };
 
         struct {
             struct xkb_context* context;
@@ -113,17 +154,7 @@ public:
             struct xkb_compose_state* composeState;
         } xkb { nullptr, nullptr, nullptr, { 0, 0, 0 }, 0, nullptr, nullptr };
 
-        struct {
-            int32_t rate;
-            int32_t delay;
-        } repeatInfo { 0, 0 };
-
-        struct {
-            uint32_t key;
-            uint32_t time;
-            uint32_t state;
-            uint32_t eventSource;
-        } repeatData { 0, 0, 0, 0 };
+        std::unique_ptr<Keyboard::KeyRepeat> keyRepeat;
 
         uint32_t serial;
 
@@ -131,25 +162,95 @@ public:
             struct wl_cursor* cursor {nullptr};
             struct wl_surface* surface {nullptr};
         } cursor;
+
+        // From the compositor timestamp of each event to its dispatch, with
+        // WPE_MESA_STATS set.
+        enum InputType { PointerMotion, PointerButton, PointerAxis, Keyboard, Touch, InputTypeCount };
+        struct {
+            bool enabled { false };
+            std::array<Stats::LatencyHistogram, InputTypeCount> dispatch;
+            // Timestamp of the first input dispatched to each view since its
+            // last commit.
+            std::unordered_map<struct wpe_view_backend*, uint32_t> pending;
+        } latency;
     };
 
-    void registerInputClient(struct wl_surface*, struct wpe_view_backend*);
+    void registerInputClient(struct wl_surface*, struct wpe_view_backend*, double scale = 1);
     void unregisterInputClient(struct wl_surface*);
+    // Ratio of the size the view renders at to the surface size.
+    void setInputScale(struct wl_surface*, double);
+
+    // Compositor timestamp, in milliseconds, of the first input event
+    // dispatched to the view since the last call, if any.
+    bool takeInputTime(struct wpe_view_backend*, uint32_t& time);
 
     void setCursor(struct wl_cursor*);
 
+    // Surface ids for the ivi-application shell, unique across the views of
+    // this process and across processes.
+    uint32_t allocateIviId();
+    void releaseIviId(uint32_t);
+
+    // Events that don't need the main context -- frame callbacks, buffer
+    // releases and presentation feedback -- go on a queue of their own for
+    // each view, dispatched from the reader thread with readerLock() held.
+    struct wl_event_queue* createViewQueue();
+    void destroyViewQueue(struct wl_event_queue*);
+    std::mutex& readerLock() { return m_reader.lock; }
+
+    // Roundtrip from the main context, waking up the reader thread after it
+    // in case events for the view queues were read in the meantime.
+    void roundtrip();
+
+    // Times the reader thread woke up, and woke up the main context, as
+    // dumped with WPE_MESA_STATS.
+    uint64_t readerWakeups() const { return m_reader.stats.wakeups; }
+    uint64_t mainWakeups() const { return m_reader.stats.mainWakeups; }
+
 private:
     Display();
     ~Display();
 
+    // KeyRepeat::Handler
+    void repeatKey(uint32_t key, uint32_t state, uint32_t time) override;
+
     struct wl_display* m_display;
     struct wl_registry* m_registry;
     Interfaces m_interfaces;
 
     SeatData m_seatData;
 
+    struct {
+        uint32_t base;
+        uint32_t stride;
+        std::vector<bool> used;
+    } m_iviIds { 0, 0, { } };
+
     GSource* m_eventSource;
+    // Input goes to the main context on a queue of its own, dispatched before
+    // the default queue.
+    struct wl_event_queue* m_inputQueue;
+
+    void startReader();
+    void stopReader();
+    void readerLoop();
+    void wakeReader();
 
+    struct {
+        std::thread thread;
+        std::mutex lock;
+        // Always empty, only used to prepare the reads.
+        struct wl_event_queue* queue { nullptr };
+        std::vector<struct wl_event_queue*> viewQueues;
+        int wakeFd { -1 };
+        std::atomic<bool> quit { false };
+
+        struct {
+            std::atomic<uint64_t> wakeups { 0 };
+            std::atomic<uint64_t> mainWakeups { 0 };
+            size_t maxViews { 0 };
+        } stats;
+    } m_reader;
 };
 
 } // namespace Wayland
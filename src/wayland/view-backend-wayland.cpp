@@ -26,21 +26,70 @@
 
 #include <wpe/wpe.h>
 
+#include <wpe-mesa/view-backend-wayland.h>
+
 #include "display.h"
 #include "ipc.h"
 #include "ipc-gbm.h"
 #include "ivi-application-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "wayland-drm-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "xdg-shell-unstable-v6-client-protocol.h"
 #include <algorithm>
 #include <cassert>
+#include <cinttypes>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <drm_fourcc.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <vector>
+
+// View activity states came with WPE 1.0.
+#if defined(WPE_CHECK_VERSION)
+#if WPE_CHECK_VERSION(1, 0, 0)
+#define WPE_MESA_VIEW_ACTIVITY_STATE 1
+#endif
+#endif
+
+#ifndef DRM_FORMAT_MOD_INVALID
+#define DRM_FORMAT_MOD_INVALID ((1ULL << 56) - 1)
+#endif
+
+namespace Wayland {
+class ViewBackend;
+}
+
+struct wpe_mesa_view_backend_wayland_subsurface {
+    // Null once the view is gone.
+    Wayland::ViewBackend* view;
+
+    struct wl_surface* surface;
+    struct wl_subsurface* subsurface;
+    struct wp_viewport* viewport;
+    bool opaque;
+
+    // Attached buffers not yet released, with their release callbacks.
+    std::unordered_map<struct wl_buffer*, std::pair<void (*)(void*), void*>> buffers;
+};
 
 namespace Wayland {
 
+static std::unordered_map<struct wpe_view_backend*, ViewBackend*>& viewBackends()
+{
+    static std::unordered_map<struct wpe_view_backend*, ViewBackend*> map;
+    return map;
+}
+
 class ViewBackend : public IPC::Host::Handler {
 public:
     ViewBackend(struct wpe_view_backend*);
@@ -54,24 +103,130 @@ public:
 
     struct wpe_view_backend* backend() { return m_backend; }
     IPC::Host& ipcHost() { return m_renderer.ipcHost; }
+    Display& display() { return m_display; }
+    struct wl_surface* surface() { return m_surface; }
+
+    static ViewBackend* fromBackend(struct wpe_view_backend*);
+
+    struct wpe_mesa_view_backend_wayland_subsurface* createSubsurface();
+    void destroySubsurface(struct wpe_mesa_view_backend_wayland_subsurface*);
+    // Subsurface position and stacking are state of the view surface.
+    void commitSubsurfaceState();
+
+    // Mirrors wpe_view_activity_state, taken by newer WPE versions.
+    enum ActivityState : uint32_t {
+        Visible = 1 << 0,
+        Focused = 1 << 1,
+        InWindow = 1 << 2,
+    };
+    void updateVisibility();
+
+    struct BufferListenerData;
+    struct Buffer {
+        BufferListenerData* owner;
+        uint32_t handle;
+        struct wl_buffer* object;
+        uint32_t width;
+        uint32_t height;
+        // Attached, and not yet released by the compositor.
+        bool busy;
+        // Left over from a previous size, destroyed once released.
+        bool stale;
+    };
 
     struct BufferListenerData {
         IPC::Host* ipcHost;
-        std::unordered_map<uint32_t, struct wl_buffer*> map;
+        std::unordered_map<uint32_t, std::unique_ptr<Buffer>> map;
+
+        struct {
+            uint64_t created;
+            uint64_t destroyed;
+            size_t maxLive;
+        } stats;
     };
 
     struct CallbackListenerData {
         IPC::Host* ipcHost;
         struct wl_callback* frameCallback;
+        // Set while the frame callback is overdue, and the view taken as hidden.
+        bool starved;
+        GSource* visibilitySource;
+    };
+
+    struct Plane {
+        uint32_t offset;
+        uint32_t stride;
+        uint64_t modifier;
+    };
+
+    struct FeedbackData {
+        IPC::Host* ipcHost;
+
+        struct FormatEntry {
+            uint32_t format;
+            uint32_t padding;
+            uint64_t modifier;
+        };
+        const FormatEntry* formatTable;
+        uint32_t formatTableSize;
+
+        struct Tranche {
+            uint32_t flags;
+            std::vector<uint16_t> indices;
+        };
+        Tranche pending;
+        std::vector<Tranche> tranches;
+    };
+
+    struct PresentationData {
+        IPC::Host* ipcHost;
+        uint32_t clockId;
+        // Outstanding feedback objects, with the handle of the buffer each was
+        // requested for, and the timestamp of the input that preceded it.
+        struct Frame {
+            uint32_t handle;
+            bool input;
+            uint32_t inputTime;
+        };
+        std::unordered_map<struct wp_presentation_feedback*, Frame> pending;
+
+        struct {
+            uint64_t presented;
+            uint64_t discarded;
+            uint64_t zeroCopy;
+            uint32_t refresh;
+
+            // Intervals between consecutive presentations, in microseconds.
+            uint64_t lastPresentation;
+            uint64_t intervals;
+            uint64_t intervalSum;
+            uint64_t intervalMin;
+            uint64_t intervalMax;
+
+            Stats::LatencyHistogram inputToPresent;
+        } stats;
     };
 
     struct ResizingData {
         struct wpe_view_backend* backend;
+        // Size of the surface, as configured by the compositor.
         uint32_t width;
         uint32_t height;
+        // WebKit renders at this fraction of the surface size.
+        double scale;
+        // Last size dispatched, as configures often repeat the current one.
+        std::pair<uint32_t, uint32_t> dispatched;
+        // Whether the shell reports the surface as activated, i.e. focused.
+        bool activated;
+        GSource* visibilitySource;
     };
 
 private:
+    struct wl_buffer* importBuffer(int fd, const IPC::GBM::BufferCommit&);
+    void destroyStaleBuffers(uint32_t width, uint32_t height);
+    void updateRenderScale(uint32_t frameTime);
+    void dropSpareBuffers();
+
     Display& m_display;
     struct wpe_view_backend* m_backend;
 
@@ -80,25 +235,128 @@ private:
     struct zxdg_surface_v6* m_xdg6Surface { nullptr };
     struct zxdg_toplevel_v6* m_toplevelSurface { nullptr };
     struct ivi_surface* m_iviSurface { nullptr };
+    uint32_t m_iviId { 0 };
+
+    std::vector<struct wpe_mesa_view_backend_wayland_subsurface*> m_subsurfaces;
+
+    // Wrappers that create their objects on the view queue, so that frame
+    // callbacks, buffer releases and presentation feedback are handled by the
+    // reader thread instead of waiting for the main context.
+    struct {
+        struct wl_event_queue* queue { nullptr };
+        struct wl_surface* surface { nullptr };
+        struct wl_drm* drm { nullptr };
+        struct zwp_linux_dmabuf_v1* linuxDmabuf { nullptr };
+        struct wp_presentation* presentation { nullptr };
+    } m_events;
 
-    BufferListenerData m_bufferData { nullptr, decltype(m_bufferData.map){ } };
-    CallbackListenerData m_callbackData { nullptr, nullptr };
-    ResizingData m_resizingData { nullptr, 0, 0 };
+    BufferListenerData m_bufferData { nullptr, decltype(m_bufferData.map){ }, { 0, 0, 0 } };
+    CallbackListenerData m_callbackData { nullptr, nullptr, false, nullptr };
+    struct zwp_linux_dmabuf_feedback_v1* m_feedback { nullptr };
+    FeedbackData m_feedbackData { nullptr, nullptr, 0, { 0, { } }, { } };
+    PresentationData m_presentationData { nullptr, CLOCK_MONOTONIC, { }, { 0, 0, 0, 0, 0, 0, 0, UINT64_MAX, 0, { } } };
+    ResizingData m_resizingData { nullptr, 0, 0, 1, { 0, 0 }, false, nullptr };
+
+    // Visibility and focus, as dispatched to WPE.
+    struct {
+        GSource* source { nullptr };
+        int64_t lastCommit { 0 };
+        uint32_t state { 0 };
+
+        struct {
+            uint64_t hidden;
+            uint64_t dropped;
+        } stats { 0, 0 };
+    } m_visibility;
+
+    // With an opaque region, compositors can skip blending the surface and
+    // put it on a plane of its own.
+    struct {
+        bool forced { false };
+        bool current { false };
+    } m_opaque;
+
+    // Rendering below the surface size, upscaled by the compositor through
+    // the viewport, either at a fixed scale or adapted to the time the
+    // renderer takes on each frame.
+    struct {
+        struct wp_viewport* viewport { nullptr };
+        std::pair<uint32_t, uint32_t> destination { 0, 0 };
+        bool automatic { false };
+
+        uint64_t frames { 0 };
+        uint64_t frameTimeSum { 0 };
+        unsigned fastWindows { 0 };
+    } m_scaling;
 
     struct {
         IPC::Host ipcHost;
         int pendingBufferFd { -1 };
+        std::vector<Plane> pendingPlanes;
+        // From the FrameTime sent ahead of the commit, 0 if none was.
+        uint32_t pendingFrameTime { 0 };
     } m_renderer;
 };
 
+static void dispatchSize(ViewBackend::ResizingData& resizingData, int32_t width, int32_t height)
+{
+    resizingData.width = std::max(0, width);
+    resizingData.height = std::max(0, height);
+
+    uint32_t scaledWidth = resizingData.width;
+    uint32_t scaledHeight = resizingData.height;
+    if (resizingData.scale < 1) {
+        scaledWidth = std::max<uint32_t>(1, std::lround(scaledWidth * resizingData.scale));
+        scaledHeight = std::max<uint32_t>(1, std::lround(scaledHeight * resizingData.scale));
+    }
+
+    // Resizing makes the renderer reallocate, so only do it for actual changes.
+    std::pair<uint32_t, uint32_t> size { scaledWidth, scaledHeight };
+    if (size == resizingData.dispatched)
+        return;
+    resizingData.dispatched = size;
+    wpe_view_backend_dispatch_set_size(resizingData.backend, scaledWidth, scaledHeight);
+}
+
+static bool hasState(struct wl_array* states, uint32_t state)
+{
+    auto* begin = static_cast<const uint32_t*>(states->data);
+    auto* end = begin + states->size / sizeof(uint32_t);
+    return std::find(begin, end, state) != end;
+}
+
+static void setActivated(ViewBackend::ResizingData& resizingData, bool activated)
+{
+    if (activated == resizingData.activated)
+        return;
+    resizingData.activated = activated;
+    if (resizingData.visibilitySource)
+        g_source_set_ready_time(resizingData.visibilitySource, 0);
+}
+
+static bool formatIsOpaque(uint32_t format)
+{
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_YUV420:
+    case DRM_FORMAT_YUYV:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static const struct xdg_surface_listener g_xdgSurfaceListener = {
     // configure
-    [](void* data, struct xdg_surface* surface, int32_t width, int32_t height, struct wl_array*, uint32_t serial)
+    [](void* data, struct xdg_surface* surface, int32_t width, int32_t height, struct wl_array* states, uint32_t serial)
     {
-        if( width != 0 || height != 0 ) {
-            struct wpe_view_backend* backend = static_cast<ViewBackend::ResizingData*>(data)->backend;
-            wpe_view_backend_dispatch_set_size(backend, std::max(0, width), std::max(0, height));
-        }
+        auto& resizingData = *static_cast<ViewBackend::ResizingData*>(data);
+        if( width != 0 || height != 0 )
+            dispatchSize(resizingData, width, height);
+        setActivated(resizingData, hasState(states, XDG_SURFACE_STATE_ACTIVATED));
         xdg_surface_ack_configure(surface, serial);
     },
     // delete
@@ -115,12 +373,12 @@ static const struct zxdg_surface_v6_listener g_xdg6SurfaceListener = {
 
 static const struct zxdg_toplevel_v6_listener g_toplevelSurfaceListener = {
     // configure
-    [](void* data, struct zxdg_toplevel_v6*, int32_t width, int32_t height, struct wl_array*)
+    [](void* data, struct zxdg_toplevel_v6*, int32_t width, int32_t height, struct wl_array* states)
     {
-        if( width != 0 || height != 0 ) {
-            struct wpe_view_backend* backend = static_cast<ViewBackend::ResizingData*>(data)->backend;
-            wpe_view_backend_dispatch_set_size(backend, std::max(0, width), std::max(0, height));
-        }
+        auto& resizingData = *static_cast<ViewBackend::ResizingData*>(data);
+        if( width != 0 || height != 0 )
+            dispatchSize(resizingData, width, height);
+        setActivated(resizingData, hasState(states, ZXDG_TOPLEVEL_V6_STATE_ACTIVATED));
     },
     // close
     [](void *data, struct zxdg_toplevel_v6 *) { },
@@ -130,30 +388,201 @@ static const struct ivi_surface_listener g_iviSurfaceListener = {
     // configure
     [](void* data, struct ivi_surface*, int32_t width, int32_t height)
     {
-        struct wpe_view_backend* backend = static_cast<ViewBackend::ResizingData*>(data)->backend;
-        wpe_view_backend_dispatch_set_size(backend, std::max(0, width), std::max(0, height));
+        dispatchSize(*static_cast<ViewBackend::ResizingData*>(data), width, height);
     },
 };
 
 const struct wl_buffer_listener g_bufferListener = {
     // release
-    [](void* data, struct wl_buffer* buffer)
+    [](void* data, struct wl_buffer*)
+    {
+        auto& buffer = *static_cast<ViewBackend::Buffer*>(data);
+        auto& bufferData = *buffer.owner;
+        buffer.busy = false;
+
+        if (bufferData.ipcHost) {
+            IPC::Message message;
+            IPC::GBM::ReleaseBuffer::construct(message, buffer.handle);
+            bufferData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        }
+
+        if (buffer.stale) {
+            wl_buffer_destroy(buffer.object);
+            ++bufferData.stats.destroyed;
+            bufferData.map.erase(buffer.handle);
+        }
+    },
+};
+
+static void sendSurfaceFeedback(ViewBackend::FeedbackData& feedbackData)
+{
+    // Tranches arrive in decreasing order of preference; forward the modifiers
+    // of the first one that can hold the format the renderer allocates.
+    const uint32_t format = DRM_FORMAT_ARGB8888;
+    uint32_t flags = 0;
+    std::vector<uint64_t> modifiers;
+    for (auto& tranche : feedbackData.tranches) {
+        for (uint16_t index : tranche.indices) {
+            if (index >= feedbackData.formatTableSize / sizeof(ViewBackend::FeedbackData::FormatEntry))
+                continue;
+            auto& entry = feedbackData.formatTable[index];
+            if (entry.format == format && entry.modifier != DRM_FORMAT_MOD_INVALID)
+                modifiers.push_back(entry.modifier);
+        }
+        if (!modifiers.empty()) {
+            if (tranche.flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT)
+                flags |= IPC::GBM::SurfaceFeedback::Scanout;
+            break;
+        }
+    }
+
+    if (!feedbackData.ipcHost)
+        return;
+
+    IPC::Message message;
+    if (modifiers.empty()) {
+        IPC::GBM::SurfaceFeedback::construct(message, format, 0, 0, 0, DRM_FORMAT_MOD_INVALID);
+        feedbackData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        return;
+    }
+
+    for (uint32_t i = 0; i < modifiers.size(); ++i) {
+        IPC::GBM::SurfaceFeedback::construct(message, format, flags, i, modifiers.size(), modifiers[i]);
+        feedbackData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+}
+
+static const struct zwp_linux_dmabuf_feedback_v1_listener g_feedbackListener = {
+    // done
+    [](void* data, struct zwp_linux_dmabuf_feedback_v1*)
     {
-        auto& bufferData = *static_cast<ViewBackend::BufferListenerData*>(data);
-        auto& bufferMap = bufferData.map;
+        auto& feedbackData = *static_cast<ViewBackend::FeedbackData*>(data);
+        sendSurfaceFeedback(feedbackData);
 
-        auto it = std::find_if(bufferMap.begin(), bufferMap.end(),
-            [buffer] (const std::pair<uint32_t, struct wl_buffer*>& entry) { return entry.second == buffer; });
+        // Every parameter is sent again on the next update.
+        feedbackData.tranches.clear();
+    },
+    // format_table
+    [](void* data, struct zwp_linux_dmabuf_feedback_v1*, int32_t fd, uint32_t size)
+    {
+        auto& feedbackData = *static_cast<ViewBackend::FeedbackData*>(data);
+        if (feedbackData.formatTable)
+            munmap(const_cast<ViewBackend::FeedbackData::FormatEntry*>(feedbackData.formatTable), feedbackData.formatTableSize);
+        feedbackData.formatTable = nullptr;
+        feedbackData.formatTableSize = 0;
 
-        if (it == bufferMap.end())
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
             return;
 
-        if (bufferData.ipcHost) {
+        feedbackData.formatTable = static_cast<const ViewBackend::FeedbackData::FormatEntry*>(mapping);
+        feedbackData.formatTableSize = size;
+    },
+    // main_device
+    // The renderer picks its own render node; only the tranches matter here.
+    [](void*, struct zwp_linux_dmabuf_feedback_v1*, struct wl_array*) { },
+    // tranche_done
+    [](void* data, struct zwp_linux_dmabuf_feedback_v1*)
+    {
+        auto& feedbackData = *static_cast<ViewBackend::FeedbackData*>(data);
+        feedbackData.tranches.push_back(std::move(feedbackData.pending));
+        feedbackData.pending = { 0, { } };
+    },
+    // tranche_target_device
+    [](void*, struct zwp_linux_dmabuf_feedback_v1*, struct wl_array*) { },
+    // tranche_formats
+    [](void* data, struct zwp_linux_dmabuf_feedback_v1*, struct wl_array* indices)
+    {
+        auto& feedbackData = *static_cast<ViewBackend::FeedbackData*>(data);
+        auto* begin = static_cast<const uint16_t*>(indices->data);
+        feedbackData.pending.indices.insert(feedbackData.pending.indices.end(), begin, begin + indices->size / sizeof(uint16_t));
+    },
+    // tranche_flags
+    [](void* data, struct zwp_linux_dmabuf_feedback_v1*, uint32_t flags)
+    {
+        static_cast<ViewBackend::FeedbackData*>(data)->pending.flags = flags;
+    },
+};
+
+// Presentation timestamps are in the compositor's clock, which is usually
+// but not necessarily CLOCK_MONOTONIC; convert them to microseconds there.
+static uint64_t presentationTime(uint32_t clockId, uint64_t seconds, uint32_t nanoseconds)
+{
+    uint64_t time = seconds * G_USEC_PER_SEC + nanoseconds / 1000;
+    if (clockId == CLOCK_MONOTONIC)
+        return time;
+
+    struct timespec now;
+    if (clock_gettime(clockId, &now))
+        return time;
+    int64_t offset = g_get_monotonic_time() - (int64_t(now.tv_sec) * G_USEC_PER_SEC + now.tv_nsec / 1000);
+    return time + offset;
+}
+
+static const struct wp_presentation_feedback_listener g_presentationFeedbackListener = {
+    // sync_output
+    [](void*, struct wp_presentation_feedback*, struct wl_output*) { },
+    // presented
+    [](void* data, struct wp_presentation_feedback* feedback, uint32_t secondsHi, uint32_t secondsLo, uint32_t nanoseconds, uint32_t refresh, uint32_t, uint32_t, uint32_t flags)
+    {
+        auto& presentationData = *static_cast<ViewBackend::PresentationData*>(data);
+        auto it = presentationData.pending.find(feedback);
+        if (it == presentationData.pending.end())
+            return;
+        auto frame = it->second;
+        presentationData.pending.erase(it);
+        wp_presentation_feedback_destroy(feedback);
+
+        uint64_t time = presentationTime(presentationData.clockId, (uint64_t(secondsHi) << 32) | secondsLo, nanoseconds);
+
+        auto& stats = presentationData.stats;
+        ++stats.presented;
+        if (flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY)
+            ++stats.zeroCopy;
+        stats.refresh = refresh;
+        if (stats.lastPresentation && time > stats.lastPresentation) {
+            uint64_t interval = time - stats.lastPresentation;
+            ++stats.intervals;
+            stats.intervalSum += interval;
+            stats.intervalMin = std::min(stats.intervalMin, interval);
+            stats.intervalMax = std::max(stats.intervalMax, interval);
+        }
+        stats.lastPresentation = time;
+
+        // Input timestamps are in milliseconds of the compositor clock,
+        // CLOCK_MONOTONIC in practice, wrapping around at 32 bits.
+        if (frame.input) {
+            uint32_t elapsed = uint32_t(time / 1000) - frame.inputTime;
+            if (elapsed < 10000)
+                stats.inputToPresent.record(uint64_t(elapsed) * 1000);
+        }
+
+        if (presentationData.ipcHost) {
+            uint32_t presentedFlags = 0;
+            if (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC)
+                presentedFlags |= IPC::GBM::FramePresented::VSync;
+            if (flags & WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK)
+                presentedFlags |= IPC::GBM::FramePresented::HardwareClock;
+            if (flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY)
+                presentedFlags |= IPC::GBM::FramePresented::ZeroCopy;
+
             IPC::Message message;
-            IPC::GBM::ReleaseBuffer::construct(message, it->first);
-            bufferData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
+            IPC::GBM::FramePresented::construct(message, frame.handle, presentedFlags, refresh, time);
+            presentationData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
         }
     },
+    // discarded
+    [](void* data, struct wp_presentation_feedback* feedback)
+    {
+        auto& presentationData = *static_cast<ViewBackend::PresentationData*>(data);
+        presentationData.pending.erase(feedback);
+        wp_presentation_feedback_destroy(feedback);
+
+        ++presentationData.stats.discarded;
+        // A skipped frame breaks the sequence of intervals.
+        presentationData.stats.lastPresentation = 0;
+    },
 };
 
 const struct wl_callback_listener g_callbackListener = {
@@ -170,23 +599,151 @@ const struct wl_callback_listener g_callbackListener = {
 
         callbackData.frameCallback = nullptr;
         wl_callback_destroy(callback);
+
+        // The compositor shows the view again.
+        if (callbackData.starved && callbackData.visibilitySource)
+            g_source_set_ready_time(callbackData.visibilitySource, 0);
+    },
+};
+
+static const struct wl_buffer_listener g_subsurfaceBufferListener = {
+    // release
+    [](void* data, struct wl_buffer* buffer)
+    {
+        auto& subsurface = *static_cast<struct wpe_mesa_view_backend_wayland_subsurface*>(data);
+        auto it = subsurface.buffers.find(buffer);
+        if (it == subsurface.buffers.end())
+            return;
+
+        auto release = it->second;
+        subsurface.buffers.erase(it);
+        wl_buffer_destroy(buffer);
+        if (release.first)
+            release.first(release.second);
     },
 };
 
+// Returns the release callbacks of the buffers still attached, for the
+// caller to run once it is done with the subsurface.
+static std::vector<std::pair<void (*)(void*), void*>> destroySubsurfaceObjects(struct wpe_mesa_view_backend_wayland_subsurface& subsurface)
+{
+    std::vector<std::pair<void (*)(void*), void*>> releases;
+    for (auto& entry : subsurface.buffers) {
+        wl_buffer_destroy(entry.first);
+        if (entry.second.first)
+            releases.push_back(entry.second);
+    }
+    subsurface.buffers.clear();
+
+    if (subsurface.viewport)
+        wp_viewport_destroy(subsurface.viewport);
+    subsurface.viewport = nullptr;
+    if (subsurface.subsurface)
+        wl_subsurface_destroy(subsurface.subsurface);
+    subsurface.subsurface = nullptr;
+    if (subsurface.surface)
+        wl_surface_destroy(subsurface.surface);
+    subsurface.surface = nullptr;
+    return releases;
+}
+
+static struct wl_buffer* importSubsurfaceBuffer(const Display::Interfaces& interfaces, const struct wpe_mesa_view_backend_wayland_dma_buf& dmaBuf)
+{
+    if (interfaces.linux_dmabuf) {
+        struct zwp_linux_buffer_params_v1* params = zwp_linux_dmabuf_v1_create_params(interfaces.linux_dmabuf);
+        for (uint32_t i = 0; i < dmaBuf.num_planes; ++i) {
+            zwp_linux_buffer_params_v1_add(params, dmaBuf.fds[i], i, dmaBuf.offsets[i], dmaBuf.strides[i],
+                dmaBuf.modifier >> 32, dmaBuf.modifier & 0xffffffff);
+        }
+
+        struct wl_buffer* buffer = zwp_linux_buffer_params_v1_create_immed(params, dmaBuf.width, dmaBuf.height, dmaBuf.format, 0);
+        zwp_linux_buffer_params_v1_destroy(params);
+        return buffer;
+    }
+
+    // wl_drm takes a single fd, and no modifiers.
+    if (interfaces.drm && dmaBuf.num_planes == 1 && (dmaBuf.modifier == DRM_FORMAT_MOD_INVALID || dmaBuf.modifier == DRM_FORMAT_MOD_LINEAR)) {
+        return wl_drm_create_prime_buffer(interfaces.drm, dmaBuf.fds[0], dmaBuf.width, dmaBuf.height, dmaBuf.format,
+            dmaBuf.offsets[0], dmaBuf.strides[0], 0, 0, 0, 0);
+    }
+    return nullptr;
+}
+
+// Compositors hold back frame callbacks for surfaces that can't be seen;
+// one overdue by this much, in microseconds, means the view got hidden.
+static const int64_t s_frameStarvationTimeout = G_USEC_PER_SEC;
+
+class VisibilitySource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    ViewBackend* backend;
+};
+
+GSourceFuncs VisibilitySource::sourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto* source = reinterpret_cast<VisibilitySource*>(base);
+        g_source_set_ready_time(base, -1);
+        source->backend->updateVisibility();
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+static void dispatchActivityState(struct wpe_view_backend* backend, uint32_t previous, uint32_t state)
+{
+#if defined(WPE_MESA_VIEW_ACTIVITY_STATE) && WPE_MESA_VIEW_ACTIVITY_STATE
+    if (uint32_t added = state & ~previous)
+        wpe_view_backend_add_activity_state(backend, added);
+    if (uint32_t removed = previous & ~state)
+        wpe_view_backend_remove_activity_state(backend, removed);
+#else
+    // This WPE can't be told; the renderer still stops with the frame callbacks.
+    (void)backend;
+    (void)previous;
+    (void)state;
+#endif
+}
+
 ViewBackend::ViewBackend(struct wpe_view_backend* backend)
     : m_display(Display::singleton())
     , m_backend(backend)
 {
+    viewBackends().insert({ backend, this });
     m_renderer.ipcHost.initialize(*this);
 
     m_surface = wl_compositor_create_surface(m_display.interfaces().compositor);
 
+    m_events.queue = m_display.createViewQueue();
+    auto wrap = [this](void* proxy) -> void* {
+        if (!proxy)
+            return nullptr;
+        void* wrapper = wl_proxy_create_wrapper(proxy);
+        wl_proxy_set_queue(static_cast<struct wl_proxy*>(wrapper), m_events.queue);
+        return wrapper;
+    };
+    m_events.surface = static_cast<struct wl_surface*>(wrap(m_surface));
+    m_events.drm = static_cast<struct wl_drm*>(wrap(m_display.interfaces().drm));
+    m_events.linuxDmabuf = static_cast<struct zwp_linux_dmabuf_v1*>(wrap(m_display.interfaces().linux_dmabuf));
+    m_events.presentation = static_cast<struct wp_presentation*>(wrap(m_display.interfaces().presentation));
+
+    m_visibility.source = g_source_new(&VisibilitySource::sourceFuncs, sizeof(VisibilitySource));
+    reinterpret_cast<VisibilitySource*>(m_visibility.source)->backend = this;
+    g_source_set_name(m_visibility.source, "[WPE] Wayland visibility");
+    g_source_attach(m_visibility.source, g_main_context_get_thread_default());
+
     // In case that more than one protocol is available pick the first that matches.
     // Priority is: IVI -> xdg_v6 > xdg
     if (m_display.interfaces().ivi_application) {
-        m_iviSurface = ivi_application_surface_create(m_display.interfaces().ivi_application,
-            4200 + getpid(), // a unique identifier
-            m_surface);
+        m_iviId = m_display.allocateIviId();
+        m_iviSurface = ivi_application_surface_create(m_display.interfaces().ivi_application, m_iviId, m_surface);
         ivi_surface_add_listener(m_iviSurface, &g_iviSurfaceListener, &m_resizingData);
     } else if (m_display.interfaces().xdg_v6) {
         m_xdg6Surface = zxdg_shell_v6_get_xdg_surface(m_display.interfaces().xdg_v6, m_surface);
@@ -195,12 +752,16 @@ ViewBackend::ViewBackend(struct wpe_view_backend* backend)
         if (m_toplevelSurface) {
             zxdg_toplevel_v6_add_listener(m_toplevelSurface, &g_toplevelSurfaceListener, &m_resizingData);
             zxdg_toplevel_v6_set_title(m_toplevelSurface, "WPE");
+            if (getenv("WPE_WAYLAND_FULLSCREEN"))
+                zxdg_toplevel_v6_set_fullscreen(m_toplevelSurface, nullptr);
             wl_surface_commit(m_surface);
         }
     } else if (m_display.interfaces().xdg) {
         m_xdgSurface = xdg_shell_get_xdg_surface(m_display.interfaces().xdg, m_surface);
         xdg_surface_add_listener(m_xdgSurface, &g_xdgSurfaceListener, &m_resizingData);
         xdg_surface_set_title(m_xdgSurface, "WPE");
+        if (getenv("WPE_WAYLAND_FULLSCREEN"))
+            xdg_surface_set_fullscreen(m_xdgSurface, nullptr);
     } else {
         fprintf(stderr, "ERROR: Unknown XDG-Shell protocol.\n");
     }
@@ -211,27 +772,129 @@ ViewBackend::ViewBackend(struct wpe_view_backend* backend)
 
     m_bufferData.ipcHost = &m_renderer.ipcHost;
     m_callbackData.ipcHost = &m_renderer.ipcHost;
+    m_callbackData.visibilitySource = m_visibility.source;
+    m_feedbackData.ipcHost = &m_renderer.ipcHost;
+    m_presentationData.ipcHost = &m_renderer.ipcHost;
+    m_presentationData.clockId = m_display.interfaces().presentation_clock_id;
     m_resizingData.backend = m_backend;
+    m_resizingData.visibilitySource = m_visibility.source;
+
+    // WPE_WAYLAND_OPAQUE tells that the content never needs blending, for
+    // embedders whose pages are always opaque while rendering with alpha.
+    m_opaque.forced = !!getenv("WPE_WAYLAND_OPAQUE");
+
+    // WPE_WAYLAND_RENDER_SCALE is either a fixed fraction of the surface size
+    // to render at, or "auto" to lower it only while frames take too long.
+    const char* renderScale = getenv("WPE_WAYLAND_RENDER_SCALE");
+    if (renderScale && !m_display.interfaces().viewporter)
+        fprintf(stderr, "ViewBackend: render scaling needs wp_viewporter, ignoring WPE_WAYLAND_RENDER_SCALE\n");
+    else if (renderScale) {
+        double scale = 1;
+        if (!strcmp(renderScale, "auto"))
+            m_scaling.automatic = true;
+        else {
+            char* end = nullptr;
+            scale = strtod(renderScale, &end);
+            if (end == renderScale || *end || !(scale > 0 && scale <= 1)) {
+                fprintf(stderr, "ViewBackend: invalid render scale '%s', expected a number in (0, 1] or 'auto'\n", renderScale);
+                scale = 1;
+            }
+        }
+        if (m_scaling.automatic || scale < 1) {
+            m_scaling.viewport = wp_viewporter_get_viewport(m_display.interfaces().viewporter, m_surface);
+            m_resizingData.scale = scale;
+        }
+    }
+
+    // Wait for the initial feedback so that it is queued for the renderer
+    // before it allocates its first buffers. Later updates follow on their own.
+    auto* linuxDmabuf = m_display.interfaces().linux_dmabuf;
+    if (linuxDmabuf && zwp_linux_dmabuf_v1_get_version(linuxDmabuf) >= ZWP_LINUX_DMABUF_V1_GET_SURFACE_FEEDBACK_SINCE_VERSION) {
+        m_feedback = zwp_linux_dmabuf_v1_get_surface_feedback(linuxDmabuf, m_surface);
+        zwp_linux_dmabuf_feedback_v1_add_listener(m_feedback, &g_feedbackListener, &m_feedbackData);
+        m_display.roundtrip();
+    }
 }
 
 ViewBackend::~ViewBackend()
 {
+    viewBackends().erase(m_backend);
     m_backend = nullptr;
 
+    // Subsurfaces stay around, inert, until destroyed through the API. Their
+    // buffers are released last, as the callbacks may destroy them.
+    std::vector<std::pair<void (*)(void*), void*>> releases;
+    for (auto* subsurface : m_subsurfaces) {
+        for (auto& release : destroySubsurfaceObjects(*subsurface))
+            releases.push_back(release);
+        subsurface->view = nullptr;
+    }
+    m_subsurfaces.clear();
+    for (auto& release : releases)
+        release.first(release.second);
+
+    // The listeners on the view queue reach into the data torn down below.
+    std::unique_lock<std::mutex> lock(m_display.readerLock());
+
+    m_callbackData.visibilitySource = nullptr;
+    if (m_visibility.source) {
+        g_source_destroy(m_visibility.source);
+        g_source_unref(m_visibility.source);
+    }
+    m_visibility.source = nullptr;
+
     m_renderer.ipcHost.deinitialize();
 
     m_display.unregisterInputClient(m_surface);
 
-    m_bufferData = { nullptr, decltype(m_bufferData.map){ } };
+    if (getenv("WPE_MESA_STATS")) {
+        auto& stats = m_bufferData.stats;
+        fprintf(stderr, "ViewBackend: %zu wl_buffers live, at most %zu, %" PRIu64 " created, %" PRIu64 " destroyed\n",
+            m_bufferData.map.size(), stats.maxLive, stats.created, stats.destroyed);
+        fprintf(stderr, "ViewBackend: hidden %" PRIu64 " times, %" PRIu64 " spare wl_buffers dropped while hidden\n",
+            m_visibility.stats.hidden, m_visibility.stats.dropped);
+    }
+    if (getenv("WPE_MESA_STATS") && m_display.interfaces().presentation) {
+        auto& stats = m_presentationData.stats;
+        fprintf(stderr, "ViewBackend: frames presented %" PRIu64 ", discarded %" PRIu64 ", zero-copy %" PRIu64 ", refresh %.2f Hz\n",
+            stats.presented, stats.discarded, stats.zeroCopy, stats.refresh ? 1000000000.0 / stats.refresh : 0.0);
+        if (stats.intervals) {
+            fprintf(stderr, "ViewBackend: presentation interval %.2f ms average, %.2f ms min, %.2f ms max over %" PRIu64 " frames\n",
+                stats.intervalSum / 1000.0 / stats.intervals, stats.intervalMin / 1000.0, stats.intervalMax / 1000.0, stats.intervals);
+        }
+        stats.inputToPresent.print("ViewBackend", "input to present");
+    }
+
+    for (auto& entry : m_presentationData.pending)
+        wp_presentation_feedback_destroy(entry.first);
+    m_presentationData.pending.clear();
+    m_presentationData.ipcHost = nullptr;
+
+    for (auto& entry : m_bufferData.map)
+        wl_buffer_destroy(entry.second->object);
+    m_bufferData = { nullptr, decltype(m_bufferData.map){ }, { 0, 0, 0 } };
 
     if (m_callbackData.frameCallback)
         wl_callback_destroy(m_callbackData.frameCallback);
-    m_callbackData = { nullptr, nullptr };
+    m_callbackData = { nullptr, nullptr, false, nullptr };
+
+    m_resizingData = { nullptr, 0, 0, 1, { 0, 0 }, false, nullptr };
 
-    m_resizingData = { nullptr, 0, 0 };
+    if (m_scaling.viewport)
+        wp_viewport_destroy(m_scaling.viewport);
+    m_scaling.viewport = nullptr;
 
-    if (m_iviSurface)
+    if (m_feedback)
+        zwp_linux_dmabuf_feedback_v1_destroy(m_feedback);
+    m_feedback = nullptr;
+    if (m_feedbackData.formatTable)
+        munmap(const_cast<FeedbackData::FormatEntry*>(m_feedbackData.formatTable), m_feedbackData.formatTableSize);
+    m_feedbackData = { nullptr, nullptr, 0, { 0, { } }, { } };
+
+    if (m_iviSurface) {
         ivi_surface_destroy(m_iviSurface);
+        m_display.releaseIviId(m_iviId);
+    }
     m_iviSurface = nullptr;
     if (m_xdgSurface)
         xdg_surface_destroy(m_xdgSurface);
@@ -242,14 +905,125 @@ ViewBackend::~ViewBackend()
     if (m_xdg6Surface)
         zxdg_surface_v6_destroy(m_xdg6Surface);
     m_xdg6Surface = nullptr;
+    for (void* wrapper : { static_cast<void*>(m_events.surface), static_cast<void*>(m_events.drm),
+        static_cast<void*>(m_events.linuxDmabuf), static_cast<void*>(m_events.presentation) }) {
+        if (wrapper)
+            wl_proxy_wrapper_destroy(wrapper);
+    }
+
     if (m_surface)
         wl_surface_destroy(m_surface);
     m_surface = nullptr;
+
+    lock.unlock();
+    m_display.destroyViewQueue(m_events.queue);
+    m_events = { };
 }
 
 void ViewBackend::initialize()
 {
-    m_display.registerInputClient(m_surface, m_backend);
+    m_display.registerInputClient(m_surface, m_backend, m_resizingData.scale);
+    updateVisibility();
+}
+
+void ViewBackend::updateVisibility()
+{
+    uint32_t state = InWindow;
+    if (m_resizingData.activated)
+        state |= Focused;
+
+    {
+        std::lock_guard<std::mutex> lock(m_display.readerLock());
+        int64_t deadline = m_visibility.lastCommit + s_frameStarvationTimeout;
+        bool starved = m_callbackData.frameCallback && g_get_monotonic_time() >= deadline;
+        if (m_callbackData.frameCallback && !starved)
+            g_source_set_ready_time(m_visibility.source, deadline);
+
+        if (starved && !m_callbackData.starved) {
+            ++m_visibility.stats.hidden;
+            dropSpareBuffers();
+        }
+        m_callbackData.starved = starved;
+        if (!starved)
+            state |= Visible;
+    }
+
+    if (state == m_visibility.state)
+        return;
+    dispatchActivityState(m_backend, m_visibility.state, state);
+    m_visibility.state = state;
+}
+
+// Nothing gets committed while the view is hidden, so the imports of the
+// buffers the compositor isn't holding are dropped; the renderer sends the
+// fd again for the next commit of each.
+void ViewBackend::dropSpareBuffers()
+{
+    auto& bufferMap = m_bufferData.map;
+    for (auto it = bufferMap.begin(); it != bufferMap.end(); ) {
+        auto& buffer = *it->second;
+        if (buffer.busy) {
+            ++it;
+            continue;
+        }
+
+        if (m_bufferData.ipcHost) {
+            IPC::Message message;
+            IPC::GBM::BufferDropped::construct(message, buffer.handle);
+            m_bufferData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        }
+
+        wl_buffer_destroy(buffer.object);
+        ++m_bufferData.stats.destroyed;
+        ++m_visibility.stats.dropped;
+        it = bufferMap.erase(it);
+    }
+}
+
+ViewBackend* ViewBackend::fromBackend(struct wpe_view_backend* backend)
+{
+    auto it = viewBackends().find(backend);
+    if (it == viewBackends().end())
+        return nullptr;
+    return it->second;
+}
+
+struct wpe_mesa_view_backend_wayland_subsurface* ViewBackend::createSubsurface()
+{
+    auto& interfaces = m_display.interfaces();
+    if (!interfaces.subcompositor)
+        return nullptr;
+
+    auto* subsurface = new wpe_mesa_view_backend_wayland_subsurface{ this, nullptr, nullptr, nullptr, false, { } };
+    subsurface->surface = wl_compositor_create_surface(interfaces.compositor);
+    subsurface->subsurface = wl_subcompositor_get_subsurface(interfaces.subcompositor, subsurface->surface, m_surface);
+    wl_subsurface_set_desync(subsurface->subsurface);
+
+    // Input goes through to the view underneath.
+    struct wl_region* region = wl_compositor_create_region(interfaces.compositor);
+    wl_surface_set_input_region(subsurface->surface, region);
+    wl_region_destroy(region);
+
+    m_subsurfaces.push_back(subsurface);
+    commitSubsurfaceState();
+    return subsurface;
+}
+
+void ViewBackend::destroySubsurface(struct wpe_mesa_view_backend_wayland_subsurface* subsurface)
+{
+    m_subsurfaces.erase(std::remove(m_subsurfaces.begin(), m_subsurfaces.end(), subsurface), m_subsurfaces.end());
+    subsurface->view = nullptr;
+
+    auto releases = destroySubsurfaceObjects(*subsurface);
+    delete subsurface;
+    for (auto& release : releases)
+        release.first(release.second);
+}
+
+void ViewBackend::commitSubsurfaceState()
+{
+    wl_surface_commit(m_surface);
+    wl_display_flush(m_display.display());
 }
 
 void ViewBackend::handleFd(int fd)
@@ -257,6 +1031,94 @@ void ViewBackend::handleFd(int fd)
     if (m_renderer.pendingBufferFd != -1)
         close(m_renderer.pendingBufferFd);
     m_renderer.pendingBufferFd = fd;
+    m_renderer.pendingPlanes.clear();
+}
+
+struct wl_buffer* ViewBackend::importBuffer(int fd, const IPC::GBM::BufferCommit& bufferCommit)
+{
+    if (!m_events.linuxDmabuf)
+        return wl_drm_create_prime_buffer(m_events.drm, fd, bufferCommit.width, bufferCommit.height, WL_DRM_FORMAT_ARGB8888, 0, bufferCommit.stride, 0, 0, 0, 0);
+
+    // Renderers built without modifier support only send the fd; describe the
+    // buffer as a single plane with an implicit layout, like wl_drm does.
+    auto& planes = m_renderer.pendingPlanes;
+    if (planes.empty())
+        planes.push_back({ 0, bufferCommit.stride, DRM_FORMAT_MOD_INVALID });
+
+    struct zwp_linux_buffer_params_v1* params = zwp_linux_dmabuf_v1_create_params(m_events.linuxDmabuf);
+    for (uint32_t i = 0; i < planes.size(); ++i) {
+        zwp_linux_buffer_params_v1_add(params, fd, i, planes[i].offset, planes[i].stride,
+            planes[i].modifier >> 32, planes[i].modifier & 0xffffffff);
+    }
+
+    struct wl_buffer* buffer = zwp_linux_buffer_params_v1_create_immed(params, bufferCommit.width, bufferCommit.height, bufferCommit.format, 0);
+    zwp_linux_buffer_params_v1_destroy(params);
+    planes.clear();
+    return buffer;
+}
+
+// The renderer allocates all of its buffers at one size, and sends the fd
+// again for any buffer committed after a resize, so buffers of any other
+// size will not be used again.
+void ViewBackend::destroyStaleBuffers(uint32_t width, uint32_t height)
+{
+    auto& bufferMap = m_bufferData.map;
+    for (auto it = bufferMap.begin(); it != bufferMap.end(); ) {
+        auto& buffer = *it->second;
+        if (buffer.width == width && buffer.height == height) {
+            ++it;
+            continue;
+        }
+
+        if (buffer.busy) {
+            buffer.stale = true;
+            ++it;
+            continue;
+        }
+
+        wl_buffer_destroy(buffer.object);
+        ++m_bufferData.stats.destroyed;
+        it = bufferMap.erase(it);
+    }
+}
+
+// The time the renderer spends on a frame is what the scale changes, unlike
+// the commit rate, which content animating below the refresh rate lowers on
+// its own. Renderers that don't report their frame times keep the scale.
+void ViewBackend::updateRenderScale(uint32_t frameTime)
+{
+    if (!m_scaling.automatic || !frameTime)
+        return;
+
+    m_scaling.frameTimeSum += frameTime;
+    if (++m_scaling.frames < 30)
+        return;
+
+    uint64_t average = m_scaling.frameTimeSum / m_scaling.frames;
+    m_scaling.frames = 0;
+    m_scaling.frameTimeSum = 0;
+
+    // A frame has to be rendered within the refresh period, with headroom for
+    // the GPU work frame_rendered doesn't wait on. Back off quickly when frames
+    // take too long, but only go up again after a while well within budget,
+    // to avoid bouncing between two scales.
+    uint32_t refresh = m_presentationData.stats.refresh;
+    uint64_t period = refresh ? refresh / 1000 : 16667;
+    double scale = m_resizingData.scale;
+    if (average > period * 3 / 4) {
+        scale = std::max(0.5, scale - 0.1);
+        m_scaling.fastWindows = 0;
+    } else if (average < period / 2 && ++m_scaling.fastWindows >= 4) {
+        scale = std::min(1.0, scale + 0.1);
+        m_scaling.fastWindows = 0;
+    }
+
+    if (std::abs(scale - m_resizingData.scale) < 0.01)
+        return;
+    m_resizingData.scale = scale;
+    m_display.setInputScale(m_surface, scale);
+    if (m_resizingData.width && m_resizingData.height)
+        dispatchSize(m_resizingData, m_resizingData.width, m_resizingData.height);
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -265,12 +1127,30 @@ void ViewBackend::handleMessage(char* data, size_t size)
         return;
 
     auto& message = IPC::Message::cast(data);
+    if (message.messageCode == IPC::GBM::BufferPlane::code) {
+        auto& bufferPlane = IPC::GBM::BufferPlane::cast(message);
+        if (bufferPlane.plane != m_renderer.pendingPlanes.size())
+            return;
+
+        uint64_t modifier = (uint64_t(bufferPlane.modifierHi) << 32) | bufferPlane.modifierLo;
+        m_renderer.pendingPlanes.push_back({ bufferPlane.offset, bufferPlane.stride, modifier });
+        return;
+    }
+
+    if (message.messageCode == IPC::GBM::FrameTime::code) {
+        m_renderer.pendingFrameTime = IPC::GBM::FrameTime::cast(message).duration;
+        return;
+    }
+
     if (message.messageCode != IPC::GBM::BufferCommit::code)
         return;
 
     auto& bufferCommit = IPC::GBM::BufferCommit::cast(message);
+    uint32_t frameTime = m_renderer.pendingFrameTime;
+    m_renderer.pendingFrameTime = 0;
+    std::lock_guard<std::mutex> lock(m_display.readerLock());
 
-    struct wl_buffer* buffer = nullptr;
+    ViewBackend::Buffer* buffer = nullptr;
     auto& bufferMap = m_bufferData.map;
     auto it = bufferMap.find(bufferCommit.handle);
 
@@ -278,31 +1158,86 @@ void ViewBackend::handleMessage(char* data, size_t size)
         int fd = m_renderer.pendingBufferFd;
         m_renderer.pendingBufferFd = -1;
 
-        buffer = wl_drm_create_prime_buffer(m_display.interfaces().drm, fd, bufferCommit.width, bufferCommit.height, WL_DRM_FORMAT_ARGB8888, 0, bufferCommit.stride, 0, 0, 0, 0);
-        wl_buffer_add_listener(buffer, &g_bufferListener, &m_bufferData);
+        // The fd is duplicated when marshalled, so it is not needed past the import.
+        struct wl_buffer* object = importBuffer(fd, bufferCommit);
+        close(fd);
 
         if (it != bufferMap.end()) {
-            wl_buffer_destroy(it->second);
-            it->second = buffer;
-        } else
-            bufferMap.insert({ bufferCommit.handle, buffer });
+            wl_buffer_destroy(it->second->object);
+            ++m_bufferData.stats.destroyed;
+            bufferMap.erase(it);
+        }
+
+        if (object) {
+            buffer = new Buffer{ &m_bufferData, bufferCommit.handle, object, bufferCommit.width, bufferCommit.height, false, false };
+            wl_buffer_add_listener(object, &g_bufferListener, buffer);
+            bufferMap.emplace(bufferCommit.handle, std::unique_ptr<Buffer>(buffer));
+
+            auto& stats = m_bufferData.stats;
+            ++stats.created;
+            destroyStaleBuffers(bufferCommit.width, bufferCommit.height);
+            stats.maxLive = std::max(stats.maxLive, bufferMap.size());
+        }
     } else {
         assert(it != bufferMap.end());
-        buffer = it->second;
+        if (it != bufferMap.end())
+            buffer = it->second.get();
     }
 
     if (!buffer) {
         fprintf(stderr, "ViewBackend: failed to create/find a buffer for PRIME handle %u\n", bufferCommit.handle);
         return;
     }
+    buffer->busy = true;
 
-    m_callbackData.frameCallback = wl_surface_frame(m_surface);
+    m_callbackData.frameCallback = wl_surface_frame(m_events.surface);
     wl_callback_add_listener(m_callbackData.frameCallback, &g_callbackListener, &m_callbackData);
 
-    wl_surface_attach(m_surface, buffer, 0, 0);
-    wl_surface_damage(m_surface, 0, 0, INT32_MAX, INT32_MAX);
+    if (m_events.presentation) {
+        struct wp_presentation_feedback* feedback = wp_presentation_feedback(m_events.presentation, m_surface);
+        wp_presentation_feedback_add_listener(feedback, &g_presentationFeedbackListener, &m_presentationData);
+        PresentationData::Frame frame { bufferCommit.handle, false, 0 };
+        frame.input = m_display.takeInputTime(m_backend, frame.inputTime);
+        m_presentationData.pending.insert({ feedback, frame });
+    }
+
+    bool opaque = m_opaque.forced || formatIsOpaque(bufferCommit.format);
+    if (opaque != m_opaque.current) {
+        struct wl_region* region = nullptr;
+        if (opaque) {
+            region = wl_compositor_create_region(m_display.interfaces().compositor);
+            wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
+        }
+        wl_surface_set_opaque_region(m_surface, region);
+        if (region)
+            wl_region_destroy(region);
+        m_opaque.current = opaque;
+    }
+
+    // Whatever size the buffer has, it covers the whole surface.
+    if (m_scaling.viewport && m_resizingData.width && m_resizingData.height) {
+        std::pair<uint32_t, uint32_t> destination { m_resizingData.width, m_resizingData.height };
+        if (destination != m_scaling.destination) {
+            wp_viewport_set_destination(m_scaling.viewport, destination.first, destination.second);
+            m_scaling.destination = destination;
+        }
+    }
+    updateRenderScale(frameTime);
+
+    // The renderer can't tell which parts of the buffer changed, so the whole
+    // buffer is damaged; in buffer coordinates when possible, which stay
+    // exact however the surface gets scaled.
+    wl_surface_attach(m_surface, buffer->object, 0, 0);
+    if (wl_surface_get_version(m_surface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+        wl_surface_damage_buffer(m_surface, 0, 0, buffer->width, buffer->height);
+    else
+        wl_surface_damage(m_surface, 0, 0, INT32_MAX, INT32_MAX);
     wl_surface_commit(m_surface);
     wl_display_flush(m_display.display());
+
+    m_visibility.lastCommit = g_get_monotonic_time();
+    if (!m_callbackData.starved)
+        g_source_set_ready_time(m_visibility.source, m_visibility.lastCommit + s_frameStarvationTimeout);
 }
 
 } // namespace Wayland
@@ -334,4 +1269,135 @@ struct wpe_view_backend_interface wayland_view_backend_interface = {
     },
 };
 
+__attribute__((visibility("default")))
+struct wpe_mesa_view_backend_wayland_subsurface*
+wpe_mesa_view_backend_wayland_create_subsurface(struct wpe_view_backend* backend)
+{
+    if (auto* viewBackend = Wayland::ViewBackend::fromBackend(backend))
+        return viewBackend->createSubsurface();
+    return nullptr;
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_wayland_subsurface_destroy(struct wpe_mesa_view_backend_wayland_subsurface* subsurface)
+{
+    if (!subsurface)
+        return;
+
+    if (subsurface->view) {
+        subsurface->view->destroySubsurface(subsurface);
+        return;
+    }
+
+    // Detached along with its view, which already released the buffers.
+    delete subsurface;
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_wayland_subsurface_set_position(struct wpe_mesa_view_backend_wayland_subsurface* subsurface, int32_t x, int32_t y)
+{
+    if (!subsurface || !subsurface->view)
+        return;
+
+    wl_subsurface_set_position(subsurface->subsurface, x, y);
+    subsurface->view->commitSubsurfaceState();
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_wayland_subsurface_set_stacking(struct wpe_mesa_view_backend_wayland_subsurface* subsurface, int above)
+{
+    if (!subsurface || !subsurface->view)
+        return;
+
+    struct wl_surface* parent = subsurface->view->surface();
+    if (above)
+        wl_subsurface_place_above(subsurface->subsurface, parent);
+    else
+        wl_subsurface_place_below(subsurface->subsurface, parent);
+    subsurface->view->commitSubsurfaceState();
+}
+
+__attribute__((visibility("default")))
+void
+wpe_mesa_view_backend_wayland_subsurface_set_size(struct wpe_mesa_view_backend_wayland_subsurface* subsurface, uint32_t width, uint32_t height)
+{
+    if (!subsurface || !subsurface->view)
+        return;
+
+    auto& display = subsurface->view->display();
+    if (!display.interfaces().viewporter) {
+        fprintf(stderr, "ViewBackend: scaling subsurfaces needs wp_viewporter\n");
+        return;
+    }
+
+    if (!subsurface->viewport)
+        subsurface->viewport = wp_viewporter_get_viewport(display.interfaces().viewporter, subsurface->surface);
+    if (width && height)
+        wp_viewport_set_destination(subsurface->viewport, width, height);
+    else
+        wp_viewport_set_destination(subsurface->viewport, -1, -1);
+
+    // Desynchronized, so this applies right away.
+    wl_surface_commit(subsurface->surface);
+    wl_display_flush(display.display());
+}
+
+__attribute__((visibility("default")))
+int
+wpe_mesa_view_backend_wayland_subsurface_attach(struct wpe_mesa_view_backend_wayland_subsurface* subsurface, const struct wpe_mesa_view_backend_wayland_dma_buf* dmaBuf, void (*release)(void*), void* userData)
+{
+    if (!subsurface || !subsurface->view)
+        return -1;
+
+    auto& display = subsurface->view->display();
+    struct wl_surface* surface = subsurface->surface;
+
+    if (!dmaBuf) {
+        wl_surface_attach(surface, nullptr, 0, 0);
+        wl_surface_commit(surface);
+        wl_display_flush(display.display());
+        return 0;
+    }
+
+    if (!dmaBuf->num_planes || dmaBuf->num_planes > 4 || !dmaBuf->width || !dmaBuf->height)
+        return -1;
+    for (uint32_t i = 0; i < dmaBuf->num_planes; ++i) {
+        if (dmaBuf->fds[i] < 0)
+            return -1;
+    }
+
+    struct wl_buffer* buffer = Wayland::importSubsurfaceBuffer(display.interfaces(), *dmaBuf);
+    if (!buffer) {
+        fprintf(stderr, "ViewBackend: failed to import a %ux%u buffer for a subsurface\n", dmaBuf->width, dmaBuf->height);
+        return -1;
+    }
+    wl_buffer_add_listener(buffer, &Wayland::g_subsurfaceBufferListener, subsurface);
+    subsurface->buffers.insert({ buffer, { release, userData } });
+
+    bool opaque = Wayland::formatIsOpaque(dmaBuf->format);
+    if (opaque != subsurface->opaque) {
+        struct wl_region* region = nullptr;
+        if (opaque) {
+            region = wl_compositor_create_region(display.interfaces().compositor);
+            wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
+        }
+        wl_surface_set_opaque_region(surface, region);
+        if (region)
+            wl_region_destroy(region);
+        subsurface->opaque = opaque;
+    }
+
+    wl_surface_attach(surface, buffer, 0, 0);
+    if (wl_surface_get_version(surface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+        wl_surface_damage_buffer(surface, 0, 0, dmaBuf->width, dmaBuf->height);
+    else
+        wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(surface);
+    wl_display_flush(display.display());
+    return 0;
+}
+
 }
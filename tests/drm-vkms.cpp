@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Drives the DRM view backend on the vkms virtual KMS driver, acting as the
+// renderer: dumb buffers allocated here are committed through the IPC
+// channel, and the host's replies are checked for flip completion, buffer
+// release ordering, a bounded number of framebuffers, and a flip rate no
+// faster than the refresh. Needs root, or at least access to the vkms card while no other
+// process is its DRM master; exits with 77 (skipped) otherwise.
+
+#include "ipc.h"
+#include "ipc-gbm.h"
+#include "view-backend-drm.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <vector>
+#include <wpe/wpe.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+static const int s_skipCode = 77;
+static const unsigned s_bufferCount = 3;
+static const unsigned s_frameCount = 300;
+static const gint64 s_frameTimeout = G_USEC_PER_SEC;
+
+static bool s_failed = false;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            s_failed = true; \
+        } \
+    } while (0)
+
+class Renderer : public IPC::Client::Handler {
+public:
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size != IPC::Message::size)
+            return;
+
+        auto& message = IPC::Message::cast(data);
+        switch (message.messageCode) {
+        case IPC::GBM::FrameComplete::code:
+            ++frameCompletes;
+            lastFrameComplete = g_get_monotonic_time();
+            break;
+        case IPC::GBM::ReleaseBuffer::code:
+        {
+            // Each buffer comes back once the one committed after it is on
+            // screen, so releases follow the commit order.
+            uint32_t handle = IPC::GBM::ReleaseBuffer::cast(message).handle;
+            CHECK(!held.empty(), "buffer %u released while the host held none", handle);
+            if (held.empty())
+                break;
+            CHECK(held.front() == handle, "buffer %u released before buffer %u", handle, held.front());
+            held.pop_front();
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    IPC::Client client;
+    unsigned frameCompletes { 0 };
+    gint64 lastFrameComplete { 0 };
+    std::deque<uint32_t> held;
+};
+
+struct Buffer {
+    uint32_t handle { 0 };
+    uint32_t pitch { 0 };
+    int fd { -1 };
+    bool sent { false };
+};
+
+static int openVkms(std::string& path)
+{
+    for (int i = 0; i < 16; ++i) {
+        path = "/dev/dri/card" + std::to_string(i);
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        drmVersionPtr version = drmGetVersion(fd);
+        bool isVkms = version && !std::strcmp(version->name, "vkms");
+        if (version)
+            drmFreeVersion(version);
+        if (isVkms)
+            return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+static bool createBuffer(int fd, uint32_t width, uint32_t height, Buffer& buffer)
+{
+    struct drm_mode_create_dumb createData = { };
+    createData.width = width;
+    createData.height = height;
+    createData.bpp = 32;
+    if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &createData))
+        return false;
+
+    buffer.handle = createData.handle;
+    buffer.pitch = createData.pitch;
+    return !drmPrimeHandleToFD(fd, buffer.handle, DRM_CLOEXEC | DRM_RDWR, &buffer.fd);
+}
+
+static void destroyBuffer(int fd, Buffer& buffer)
+{
+    if (buffer.fd >= 0)
+        close(buffer.fd);
+    if (buffer.handle) {
+        struct drm_mode_destroy_dumb destroyData = { };
+        destroyData.handle = buffer.handle;
+        drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyData);
+    }
+    buffer = Buffer();
+}
+
+// Framebuffers of every client are listed in debugfs, which tells whether the
+// host keeps a bounded set of them. Returns -1 when debugfs isn't available.
+static int framebufferCount(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+        return -1;
+
+    std::string path = "/sys/kernel/debug/dri/" + std::to_string(minor(st.st_rdev)) + "/framebuffer";
+    gchar* contents = nullptr;
+    if (!g_file_get_contents(path.c_str(), &contents, nullptr, nullptr))
+        return -1;
+
+    int count = 0;
+    for (const char* line = contents; (line = std::strstr(line, "framebuffer[")); ++line)
+        ++count;
+    g_free(contents);
+    return count;
+}
+
+static uint32_t activeRefresh(int fd)
+{
+    drmModeRes* resources = drmModeGetResources(fd);
+    if (!resources)
+        return 0;
+
+    uint32_t refresh = 0;
+    for (int i = 0; i < resources->count_crtcs && !refresh; ++i) {
+        drmModeCrtc* crtc = drmModeGetCrtc(fd, resources->crtcs[i]);
+        if (!crtc)
+            continue;
+        if (crtc->mode_valid && crtc->mode.htotal && crtc->mode.vtotal)
+            refresh = crtc->mode.vrefresh;
+        drmModeFreeCrtc(crtc);
+    }
+    drmModeFreeResources(resources);
+    return refresh;
+}
+
+template<typename F>
+static bool waitFor(F condition)
+{
+    gint64 deadline = g_get_monotonic_time() + s_frameTimeout;
+    while (!condition()) {
+        if (g_get_monotonic_time() > deadline)
+            return false;
+        g_main_context_iteration(nullptr, TRUE);
+    }
+    return true;
+}
+
+int main()
+{
+    std::string path;
+    int fd = openVkms(path);
+    if (fd < 0) {
+        fprintf(stderr, "SKIP: no vkms device, it can be loaded with 'modprobe vkms'\n");
+        return s_skipCode;
+    }
+
+    // The buffers are allocated through this fd, but the backend opens the
+    // card on its own and has to become DRM master there.
+    drmDropMaster(fd);
+    setenv("WPE_RENDER_CARD", path.c_str(), 1);
+    setenv("WPE_DRM_DISABLE_INPUT", "1", 1);
+
+    // Keeps the main loop waking up while waiting on the host.
+    g_timeout_add(10, [](gpointer) -> gboolean { return G_SOURCE_CONTINUE; }, nullptr);
+
+    int baseFramebuffers = framebufferCount(fd);
+
+    std::pair<uint32_t, uint32_t> size { 0, 0 };
+    static struct wpe_view_backend_client s_backendClient = {
+        // set_size
+        [](void* data, uint32_t width, uint32_t height)
+        {
+            *static_cast<std::pair<uint32_t, uint32_t>*>(data) = { width, height };
+        },
+        // frame_displayed
+        [](void*) { },
+    };
+
+    struct wpe_view_backend* backend = wpe_view_backend_create_with_backend_interface(&drm_view_backend_interface, nullptr);
+    wpe_view_backend_set_backend_client(backend, &s_backendClient, &size);
+    wpe_view_backend_initialize(backend);
+    if (!size.first || !size.second) {
+        fprintf(stderr, "SKIP: %s has no usable output, or another process is its DRM master\n", path.c_str());
+        wpe_view_backend_destroy(backend);
+        close(fd);
+        return s_skipCode;
+    }
+
+    std::vector<Buffer> buffers(s_bufferCount);
+    for (auto& buffer : buffers) {
+        if (!createBuffer(fd, size.first, size.second, buffer)) {
+            fprintf(stderr, "SKIP: couldn't export %ux%u dumb buffers from %s: %s\n", size.first, size.second, path.c_str(), strerror(errno));
+            for (auto& buffer : buffers)
+                destroyBuffer(fd, buffer);
+            wpe_view_backend_destroy(backend);
+            close(fd);
+            return s_skipCode;
+        }
+    }
+
+    Renderer renderer;
+    renderer.client.initialize(renderer, wpe_view_backend_get_renderer_host_fd(backend));
+
+    int steadyFramebuffers = -1;
+    gint64 firstFrameComplete = 0;
+    for (unsigned frame = 0; frame < s_frameCount && !s_failed; ++frame) {
+        // Cycle through the buffers the host isn't holding on to.
+        Buffer* buffer = nullptr;
+        for (unsigned i = 0; i < s_bufferCount && !buffer; ++i) {
+            auto& candidate = buffers[(frame + i) % s_bufferCount];
+            bool held = false;
+            for (uint32_t handle : renderer.held)
+                held |= handle == candidate.handle;
+            if (!held)
+                buffer = &candidate;
+        }
+        CHECK(buffer, "the host holds all %u buffers after frame %u", s_bufferCount, frame);
+        if (!buffer)
+            break;
+
+        // Halfway through, one buffer is sent again under its known handle,
+        // as the renderer does after a resize, which must replace the old
+        // framebuffer rather than add one.
+        if (!buffer->sent || frame == s_frameCount / 2) {
+            renderer.client.sendFd(buffer->fd);
+            buffer->sent = true;
+        }
+
+        IPC::Message message;
+        IPC::GBM::BufferCommit::construct(message, buffer->handle, size.first, size.second, buffer->pitch, DRM_FORMAT_XRGB8888);
+        renderer.client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        renderer.held.push_back(buffer->handle);
+
+        unsigned expected = renderer.frameCompletes + 1;
+        CHECK(waitFor([&] { return renderer.frameCompletes >= expected; }), "frame %u never completed", frame);
+        CHECK(renderer.frameCompletes == expected, "frame %u completed %u times", frame, renderer.frameCompletes - expected + 1);
+        CHECK(renderer.held.size() <= 2, "the host holds %zu buffers after frame %u", renderer.held.size(), frame);
+
+        // The first frame is shown by the modeset, without waiting on a vblank.
+        if (frame == 1)
+            firstFrameComplete = renderer.lastFrameComplete;
+        if (frame == s_bufferCount)
+            steadyFramebuffers = framebufferCount(fd);
+    }
+
+    if (!s_failed) {
+        int framebuffers = framebufferCount(fd);
+        if (framebuffers >= 0 && baseFramebuffers >= 0) {
+            CHECK(framebuffers <= baseFramebuffers + int(s_bufferCount),
+                "%d framebuffers for %u buffers", framebuffers - baseFramebuffers, s_bufferCount);
+            CHECK(framebuffers == steadyFramebuffers,
+                "framebuffers went from %d to %d after sending a buffer again", steadyFramebuffers, framebuffers);
+        } else
+            fprintf(stderr, "note: debugfs isn't readable, the framebuffer count isn't checked\n");
+
+        // Flips complete once per vblank, so the rate can't exceed the
+        // refresh whatever the load. A rate below it is only reported, as a
+        // loaded test machine misses vblanks as well as a slow backend does.
+        uint32_t refresh = activeRefresh(fd);
+        double elapsed = (renderer.lastFrameComplete - firstFrameComplete) / double(G_USEC_PER_SEC);
+        double rate = elapsed > 0 ? (s_frameCount - 2) / elapsed : 0;
+        fprintf(stderr, "%u frames at %.1f flips/s on a %u Hz mode\n", s_frameCount, rate, refresh);
+        if (refresh) {
+            CHECK(rate <= refresh * 1.05, "%.1f flips/s is faster than the %u Hz refresh", rate, refresh);
+            if (rate < refresh * 0.75)
+                fprintf(stderr, "note: %.1f flips/s doesn't sustain the %u Hz refresh\n", rate, refresh);
+        }
+    }
+
+    renderer.client.deinitialize();
+    wpe_view_backend_destroy(backend);
+    for (auto& buffer : buffers)
+        destroyBuffer(fd, buffer);
+    close(fd);
+
+    if (s_failed)
+        return EXIT_FAILURE;
+    fprintf(stderr, "PASS\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Drives the key repeat timer from the main loop, and checks that the first
+// repeat comes after the delay and the next ones at the rate, on time and
+// stamped from the key event, that a busy main loop gets a single repeat for
+// the periods it missed without losing the phase, and that stopping drops
+// repeats already due.
+
+#include "key-repeat.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <glib.h>
+#include <vector>
+
+static const int32_t s_rate = 25;
+static const int32_t s_delay = 200;
+static const gint64 s_period = G_USEC_PER_SEC / s_rate;
+// How late a repeat may be dispatched, for loaded machines.
+static const gint64 s_lateness = 50 * 1000;
+static const uint32_t s_key = 38;
+static const uint32_t s_state = 1;
+
+static bool s_failed = false;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            s_failed = true; \
+        } \
+    } while (0)
+
+class Recorder : public Keyboard::KeyRepeat::Handler {
+public:
+    struct Repeat {
+        gint64 dispatchTime;
+        uint32_t key;
+        uint32_t state;
+        uint32_t time;
+    };
+
+    void repeatKey(uint32_t key, uint32_t state, uint32_t time) override
+    {
+        repeats.push_back({ g_get_monotonic_time(), key, state, time });
+    }
+
+    std::vector<Repeat> repeats;
+};
+
+// Iterates the main loop until the condition holds or the time runs out.
+template<typename Condition>
+static void runUntil(gint64 duration, Condition condition)
+{
+    bool timedOut = false;
+    guint timeout = g_timeout_add(duration / 1000,
+        [](gpointer data) -> gboolean
+        {
+            *static_cast<bool*>(data) = true;
+            return G_SOURCE_REMOVE;
+        }, &timedOut);
+
+    while (!timedOut && !condition())
+        g_main_context_iteration(nullptr, TRUE);
+
+    if (!timedOut)
+        g_source_remove(timeout);
+}
+
+static void runFor(gint64 duration)
+{
+    runUntil(duration, [] { return false; });
+}
+
+// Stamps are in milliseconds of CLOCK_MONOTONIC, like compositor timestamps.
+static uint32_t now(gint64& start)
+{
+    start = g_get_monotonic_time();
+    return start / 1000;
+}
+
+static void testCadence(Keyboard::KeyRepeat& keyRepeat, Recorder& recorder)
+{
+    const size_t count = 10;
+    recorder.repeats.clear();
+
+    gint64 start;
+    uint32_t time = now(start);
+    keyRepeat.start(s_key, s_state, time);
+    runUntil(2 * G_USEC_PER_SEC, [&] { return recorder.repeats.size() >= count; });
+    keyRepeat.stop();
+
+    CHECK(recorder.repeats.size() >= count, "%zu repeats out of %zu", recorder.repeats.size(), count);
+    for (size_t i = 0; i < recorder.repeats.size() && i < count; ++i) {
+        auto& repeat = recorder.repeats[i];
+        gint64 due = start + s_delay * 1000 + i * s_period;
+        CHECK(repeat.key == s_key && repeat.state == s_state, "repeat %zu of key %u state %u", i, repeat.key, repeat.state);
+        CHECK(repeat.time == time + s_delay + i * s_period / 1000, "repeat %zu stamped %d ms after the key",
+            i, int(repeat.time - time));
+        // The timer is armed after the start time is taken, so no repeat is
+        // due before these times.
+        CHECK(repeat.dispatchTime >= due, "repeat %zu %" G_GINT64_FORMAT " us early", i, due - repeat.dispatchTime);
+        CHECK(repeat.dispatchTime <= due + s_lateness, "repeat %zu %" G_GINT64_FORMAT " us late", i, repeat.dispatchTime - due);
+    }
+}
+
+static void testBusyMainLoop(Keyboard::KeyRepeat& keyRepeat, Recorder& recorder)
+{
+    recorder.repeats.clear();
+
+    gint64 start;
+    uint32_t time = now(start);
+    keyRepeat.start(s_key, s_state, time);
+
+    // Blocks the main loop over a few periods past the delay.
+    g_usleep(s_delay * 1000 + 5 * s_period / 2);
+    g_main_context_iteration(nullptr, FALSE);
+    CHECK(recorder.repeats.size() == 1, "%zu repeats dispatched at once after a busy main loop", recorder.repeats.size());
+    if (recorder.repeats.empty()) {
+        keyRepeat.stop();
+        return;
+    }
+
+    // The late repeat is stamped with the last period that elapsed.
+    auto missed = recorder.repeats[0];
+    uint32_t periods = (missed.time - time - s_delay) / (s_period / 1000);
+    CHECK(periods >= 2, "late repeat stamped %d ms after the key", int(missed.time - time));
+    CHECK(missed.time == time + s_delay + periods * s_period / 1000, "late repeat stamped %d ms after the key, off the period",
+        int(missed.time - time));
+
+    // The next one keeps the phase of the timer.
+    runUntil(2 * s_period + s_lateness, [&] { return recorder.repeats.size() >= 2; });
+    keyRepeat.stop();
+
+    CHECK(recorder.repeats.size() == 2, "no repeat after the late one");
+    if (recorder.repeats.size() < 2)
+        return;
+
+    auto& next = recorder.repeats[1];
+    gint64 due = start + s_delay * 1000 + (periods + 1) * s_period;
+    CHECK(next.time == missed.time + s_period / 1000, "repeat after the late one stamped %d ms after it", int(next.time - missed.time));
+    CHECK(next.dispatchTime >= due && next.dispatchTime <= due + s_lateness, "repeat after the late one %" G_GINT64_FORMAT " us off the phase",
+        next.dispatchTime - due);
+}
+
+static void testStop(Keyboard::KeyRepeat& keyRepeat, Recorder& recorder)
+{
+    recorder.repeats.clear();
+
+    // Before the delay runs out.
+    gint64 start;
+    keyRepeat.start(s_key, s_state, now(start));
+    runFor(s_delay * 1000 / 2);
+    keyRepeat.stop();
+    runFor(s_delay * 1000 + 2 * s_period);
+    CHECK(recorder.repeats.empty(), "%zu repeats after stopping before the delay", recorder.repeats.size());
+    CHECK(!keyRepeat.key(), "key %u still repeating after stopping", keyRepeat.key());
+
+    // With repeats due but not dispatched yet.
+    recorder.repeats.clear();
+    keyRepeat.start(s_key, s_state, now(start));
+    g_usleep(s_delay * 1000 + 2 * s_period);
+    keyRepeat.stop();
+    runFor(2 * s_period);
+    CHECK(recorder.repeats.empty(), "%zu repeats due when stopping were dispatched", recorder.repeats.size());
+}
+
+static void testDisabled(Keyboard::KeyRepeat& keyRepeat, Recorder& recorder)
+{
+    recorder.repeats.clear();
+
+    // A zero rate stops a repeating key, and keeps keys from repeating.
+    gint64 start;
+    keyRepeat.start(s_key, s_state, now(start));
+    keyRepeat.setInfo(0, s_delay);
+    CHECK(!keyRepeat.isEnabled(), "repeat enabled with a zero rate");
+    keyRepeat.start(s_key, s_state, now(start));
+    runFor(s_delay * 1000 + 2 * s_period);
+    CHECK(recorder.repeats.empty(), "%zu repeats with a zero rate", recorder.repeats.size());
+
+    keyRepeat.setInfo(s_rate, s_delay);
+}
+
+int main()
+{
+    Recorder recorder;
+    Keyboard::KeyRepeat keyRepeat(recorder);
+    if (!keyRepeat.isValid()) {
+        fprintf(stderr, "FAIL: no key repeat timer\n");
+        return EXIT_FAILURE;
+    }
+
+    keyRepeat.setInfo(s_rate, s_delay);
+    CHECK(keyRepeat.isEnabled(), "repeat disabled at %d repeats per second", s_rate);
+
+    testCadence(keyRepeat, recorder);
+    testBusyMainLoop(keyRepeat, recorder);
+    testStop(keyRepeat, recorder);
+    testDisabled(keyRepeat, recorder);
+
+    if (s_failed)
+        return EXIT_FAILURE;
+
+    fprintf(stderr, "PASS: first repeat after %d ms, then %d per second\n", s_delay, s_rate);
+    return EXIT_SUCCESS;
+}
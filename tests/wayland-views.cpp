@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2017 Igalia S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Measures the per-view overhead of the Wayland view backend as the number
+// of views sharing the Display grows from 1 to 16: resident memory, and
+// wakeups of the reader thread and of the main context per frame. Acts as
+// the renderer of every view, committing buffers allocated through gbm on a
+// render node. Exits with 77 (skipped) without a compositor or render node.
+
+#include "display.h"
+#include "ipc.h"
+#include "ipc-gbm.h"
+#include "view-backend-wayland.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <gbm.h>
+#include <glib.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <wayland-client.h>
+#include <wpe/wpe.h>
+
+static const int s_skipCode = 77;
+static const uint32_t s_width = 256;
+static const uint32_t s_height = 256;
+static const unsigned s_frameCount = 120;
+static const gint64 s_frameTimeout = 2 * G_USEC_PER_SEC;
+
+class View : public IPC::Client::Handler {
+public:
+    View(struct gbm_device*);
+    ~View();
+
+    bool isValid() const { return m_valid; }
+    unsigned frames() const { return m_frames; }
+
+    bool commit();
+
+    void handleMessage(char*, size_t) override;
+
+private:
+    struct Buffer {
+        struct gbm_bo* bo { nullptr };
+        int fd { -1 };
+        bool sent { false };
+        bool held { false };
+    };
+
+    struct wpe_view_backend* m_backend;
+    IPC::Client m_client;
+    std::array<Buffer, 3> m_buffers;
+    unsigned m_frames { 0 };
+    bool m_valid { true };
+};
+
+View::View(struct gbm_device* device)
+{
+    m_backend = wpe_view_backend_create_with_backend_interface(&wayland_view_backend_interface, nullptr);
+    wpe_view_backend_initialize(m_backend);
+    m_client.initialize(*this, wpe_view_backend_get_renderer_host_fd(m_backend));
+
+    for (auto& buffer : m_buffers) {
+        buffer.bo = gbm_bo_create(device, s_width, s_height, GBM_FORMAT_XRGB8888, GBM_BO_USE_RENDERING);
+        buffer.fd = buffer.bo ? gbm_bo_get_fd(buffer.bo) : -1;
+        m_valid &= buffer.fd >= 0;
+    }
+}
+
+View::~View()
+{
+    m_client.deinitialize();
+    wpe_view_backend_destroy(m_backend);
+
+    for (auto& buffer : m_buffers) {
+        if (buffer.fd >= 0)
+            close(buffer.fd);
+        if (buffer.bo)
+            gbm_bo_destroy(buffer.bo);
+    }
+}
+
+// Handles are the buffer indexes plus one, as zero means no buffer.
+bool View::commit()
+{
+    for (uint32_t i = 0; i < m_buffers.size(); ++i) {
+        auto& buffer = m_buffers[i];
+        if (buffer.held)
+            continue;
+
+        if (!buffer.sent) {
+            m_client.sendFd(buffer.fd);
+            buffer.sent = true;
+        }
+
+        IPC::Message message;
+        IPC::GBM::BufferCommit::construct(message, i + 1, s_width, s_height, gbm_bo_get_stride(buffer.bo), GBM_FORMAT_XRGB8888);
+        m_client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        buffer.held = true;
+        return true;
+    }
+    return false;
+}
+
+void View::handleMessage(char* data, size_t size)
+{
+    if (size != IPC::Message::size)
+        return;
+
+    auto& message = IPC::Message::cast(data);
+    switch (message.messageCode) {
+    case IPC::GBM::FrameComplete::code:
+        ++m_frames;
+        break;
+    case IPC::GBM::ReleaseBuffer::code:
+    {
+        uint32_t handle = IPC::GBM::ReleaseBuffer::cast(message).handle;
+        if (handle && handle <= m_buffers.size())
+            m_buffers[handle - 1].held = false;
+        break;
+    }
+    case IPC::GBM::BufferDropped::code:
+    {
+        uint32_t handle = IPC::GBM::BufferDropped::cast(message).handle;
+        if (handle && handle <= m_buffers.size())
+            m_buffers[handle - 1].sent = false;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static uint64_t residentKiB()
+{
+    gchar* contents = nullptr;
+    if (!g_file_get_contents("/proc/self/statm", &contents, nullptr, nullptr))
+        return 0;
+
+    unsigned long size = 0, resident = 0;
+    sscanf(contents, "%lu %lu", &size, &resident);
+    g_free(contents);
+    return uint64_t(resident) * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static int openRenderNode()
+{
+    for (int i = 128; i < 192; ++i) {
+        std::string path = "/dev/dri/renderD" + std::to_string(i);
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd >= 0)
+            return fd;
+    }
+    return -1;
+}
+
+int main()
+{
+    // The view backends abort without a compositor, so check on a
+    // connection of our own first.
+    struct wl_display* display = wl_display_connect(nullptr);
+    if (!display) {
+        fprintf(stderr, "SKIP: no Wayland compositor to connect to\n");
+        return s_skipCode;
+    }
+    wl_display_disconnect(display);
+
+    int fd = openRenderNode();
+    struct gbm_device* device = fd >= 0 ? gbm_create_device(fd) : nullptr;
+    if (!device) {
+        fprintf(stderr, "SKIP: no render node to allocate buffers from\n");
+        if (fd >= 0)
+            close(fd);
+        return s_skipCode;
+    }
+
+    auto& waylandDisplay = Wayland::Display::singleton();
+    if (!waylandDisplay.interfaces().linux_dmabuf && !waylandDisplay.interfaces().drm) {
+        fprintf(stderr, "SKIP: the compositor supports neither zwp_linux_dmabuf_v1 nor wl_drm\n");
+        gbm_device_destroy(device);
+        close(fd);
+        return s_skipCode;
+    }
+
+    // Keeps the main loop waking up while waiting on the views.
+    g_timeout_add(100, [](gpointer) -> gboolean { return G_SOURCE_CONTINUE; }, nullptr);
+
+    bool failed = false;
+    fprintf(stderr, "views  KiB/view  reader wakeups/frame  main wakeups/frame  main loop iterations/frame\n");
+    for (unsigned viewCount : { 1, 2, 4, 8, 16 }) {
+        uint64_t baseResident = residentKiB();
+        uint64_t baseReaderWakeups = waylandDisplay.readerWakeups();
+        uint64_t baseMainWakeups = waylandDisplay.mainWakeups();
+        uint64_t iterations = 0;
+
+        std::vector<std::unique_ptr<View>> views;
+        for (unsigned i = 0; i < viewCount; ++i) {
+            views.emplace_back(new View(device));
+            if (!views.back()->isValid()) {
+                fprintf(stderr, "FAIL: couldn't allocate %ux%u buffers\n", s_width, s_height);
+                failed = true;
+            }
+        }
+
+        // All views render in lockstep, each waiting on its own frame.
+        for (unsigned frame = 0; frame < s_frameCount && !failed; ++frame) {
+            for (auto& view : views) {
+                gint64 deadline = g_get_monotonic_time() + s_frameTimeout;
+                while (!view->commit() && g_get_monotonic_time() < deadline) {
+                    g_main_context_iteration(nullptr, TRUE);
+                    ++iterations;
+                }
+            }
+
+            gint64 deadline = g_get_monotonic_time() + s_frameTimeout;
+            auto pending = [&] {
+                for (auto& view : views) {
+                    if (view->frames() <= frame)
+                        return true;
+                }
+                return false;
+            };
+            while (pending() && g_get_monotonic_time() < deadline) {
+                g_main_context_iteration(nullptr, TRUE);
+                ++iterations;
+            }
+            if (pending()) {
+                fprintf(stderr, "FAIL: frame %u of %u views never completed\n", frame, viewCount);
+                failed = true;
+            }
+        }
+
+        if (!failed) {
+            double frames = double(s_frameCount) * viewCount;
+            uint64_t resident = residentKiB();
+            fprintf(stderr, "%5u  %8.1f  %20.2f  %18.2f  %26.2f\n", viewCount,
+                resident > baseResident ? double(resident - baseResident) / viewCount : 0.0,
+                (waylandDisplay.readerWakeups() - baseReaderWakeups) / frames,
+                (waylandDisplay.mainWakeups() - baseMainWakeups) / frames,
+                iterations / frames);
+        }
+
+        views.clear();
+        if (failed)
+            break;
+    }
+
+    gbm_device_destroy(device);
+    close(fd);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}